@@ -31,8 +31,10 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         srand(seed);
 #ifdef GPU
         cuda_set_device(gpus[i]);
-#endif
         nets[i] = load_network(cfgfile, weightfile, clear);
+#else
+        nets[i] = i ? clone_network_shared(nets[0], 0) : load_network(cfgfile, weightfile, clear);
+#endif
         nets[i]->learning_rate *= ngpus;
     }
     srand(time(0));
@@ -137,7 +139,11 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
             loss = train_networks(nets, ngpus, train, 4);
         }
 #else
-        loss = train_network(net, train);
+        if(ngpus == 1){
+            loss = train_network(net, train);
+        } else {
+            loss = train_network_replicas(nets, ngpus, train);
+        }
 #endif
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
@@ -481,7 +487,13 @@ void validate_classifier_multi(char *datacfg, char *cfg, char *weights)
 
 void try_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int layer_num)
 {
-    network *net = load_network(cfgfile, weightfile, 0);
+    network *net;
+    if(layer_num < 0){
+        net = load_network(cfgfile, weightfile, 0);
+    }else{
+        net = parse_network_cfg_for_output(cfgfile, layer_num);
+        if(weightfile) load_weights(net, weightfile);
+    }
     set_batch_network(net, 1);
     srand(2222222);
 
@@ -490,6 +502,7 @@ void try_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filena
     char *name_list = option_find_str(options, "names", 0);
     if(!name_list) name_list = option_find_str(options, "labels", "data/labels.list");
     int top = option_find_int(options, "top", 1);
+    int classes = option_find_int(options, "classes", 2);
 
     int i = 0;
     char **names = get_labels(name_list);
@@ -523,7 +536,7 @@ void try_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filena
         time=clock();
         float *predictions = network_predict(net, X);
 
-        layer l = net->layers[layer_num];
+        layer l = net->layers[net->n - 1];
         for(i = 0; i < l.c; ++i){
             if(l.rolling_mean) printf("%f %f %f\n", l.rolling_mean[i], l.rolling_variance[i], l.scales[i]);
         }
@@ -546,11 +559,13 @@ void try_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filena
            }
          */
 
-        top_predictions(net, top, indexes);
         printf("%s: Predicted in %f seconds.\n", input, sec(clock()-time));
-        for(i = 0; i < top; ++i){
-            int index = indexes[i];
-            printf("%s: %f\n", names[index], predictions[index]);
+        if(net->outputs == classes){
+            top_predictions(net, top, indexes);
+            for(i = 0; i < top; ++i){
+                int index = indexes[i];
+                printf("%s: %f\n", names[index], predictions[index]);
+            }
         }
         free_image(im);
         if (filename) break;
@@ -1067,6 +1082,13 @@ void run_classifier(int argc, char **argv)
     char *gpu_list = find_char_arg(argc, argv, "-gpus", 0);
     int ngpus;
     int *gpus = read_intlist(gpu_list, &ngpus, gpu_index);
+#ifndef GPU
+    int replicas = find_int_arg(argc, argv, "-replicas", 0);
+    if(replicas > 1){
+        gpus = calloc(replicas, sizeof(int));
+        ngpus = replicas;
+    }
+#endif
 
 
     int cam_index = find_int_arg(argc, argv, "-c", 0);
@@ -1080,7 +1102,7 @@ void run_classifier(int argc, char **argv)
     int layer = layer_s ? atoi(layer_s) : -1;
     if(0==strcmp(argv[2], "predict")) predict_classifier(data, cfg, weights, filename, top);
     else if(0==strcmp(argv[2], "fout")) file_output_classifier(data, cfg, weights, filename);
-    else if(0==strcmp(argv[2], "try")) try_classifier(data, cfg, weights, filename, atoi(layer_s));
+    else if(0==strcmp(argv[2], "try")) try_classifier(data, cfg, weights, filename, layer);
     else if(0==strcmp(argv[2], "train")) train_classifier(data, cfg, weights, gpus, ngpus, clear);
     else if(0==strcmp(argv[2], "demo")) demo_classifier(data, cfg, weights, cam_index, filename);
     else if(0==strcmp(argv[2], "gun")) gun_classifier(data, cfg, weights, cam_index, filename);
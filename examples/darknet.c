@@ -184,10 +184,27 @@ void oneoff2(char *cfgfile, char *weightfile, char *outfile, int l)
 void partial(char *cfgfile, char *weightfile, char *outfile, int max)
 {
     gpu_index = -1;
-    network *net = load_network(cfgfile, weightfile, 1);
+    network *net = parse_network_cfg_upto(cfgfile, max);
+    if(weightfile){
+        load_weights(net, weightfile);
+    }
+    *net->seen = 0;
     save_weights_upto(net, outfile, max);
 }
 
+void map_weights(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network *net = load_network(cfgfile, weightfile, 0);
+    save_weights_mapped(net, outfile);
+}
+
+void compile_plan_file(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    compile_plan(cfgfile, weightfile, outfile);
+}
+
 void print_weights(char *cfgfile, char *weightfile, int n)
 {
     gpu_index = -1;
@@ -487,6 +504,10 @@ int main(int argc, char **argv)
         print_weights(argv[2], argv[3], atoi(argv[4]));
     } else if (0 == strcmp(argv[1], "partial")){
         partial(argv[2], argv[3], argv[4], atoi(argv[5]));
+    } else if (0 == strcmp(argv[1], "map")){
+        map_weights(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "compile")){
+        compile_plan_file(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "average")){
         average(argc, argv);
     } else if (0 == strcmp(argv[1], "visualize")){
@@ -3,7 +3,7 @@
 static int coco_ids[] = {1,2,3,4,5,6,7,8,9,10,11,13,14,15,16,17,18,19,20,21,22,23,24,25,27,28,31,32,33,34,35,36,37,38,39,40,41,42,43,44,46,47,48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63,64,65,67,70,72,73,74,75,76,77,78,79,80,81,82,84,85,86,87,88,89,90};
 
 
-void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, int ngpus, int clear)
+void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, int ngpus, int clear, char *ringspec, int rank, int world, int keep)
 {
     list *options = read_data_cfg(datacfg);
     char *train_images = option_find_str(options, "train", "data/train.list");
@@ -23,12 +23,23 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
         srand(seed);
 #ifdef GPU
         cuda_set_device(gpus[i]);
-#endif
         nets[i] = load_network(cfgfile, weightfile, clear);
+#else
+        nets[i] = i ? clone_network_shared(nets[0], 0) : load_network(cfgfile, weightfile, clear);
+#endif
+        if(weightfile && !clear && !nets[i]->shared_weights) load_optimizer_state(nets[i], weightfile);
         nets[i]->learning_rate *= ngpus;
     }
-    srand(time(0));
+    ring *r = 0;
+    if(ringspec){
+        if(ngpus != 1) error("Ring training takes one network per process");
+        r = make_ring(ringspec, rank, world);
+        join_ring(nets[0], r);
+        nets[0]->learning_rate *= world;
+    }
+    srand(time(0) + rank);
     network *net = nets[0];
+    checkpointer *ckpt = make_checkpointer(keep);
 
     int imgs = net->batch * net->subdivisions * ngpus;
     printf("Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
@@ -128,7 +139,11 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             loss = train_networks(nets, ngpus, train, 4);
         }
 #else
-        loss = train_network(net, train);
+        if(ngpus == 1){
+            loss = train_network(net, train);
+        } else {
+            loss = train_network_replicas(nets, ngpus, train);
+        }
 #endif
         if (avg_loss < 0) 
             avg_loss = loss;
@@ -136,23 +151,23 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 
         i = get_current_batch(net);
         printf("%ld: %f, %f avg, %f rate, %lf seconds, %d images\n", get_current_batch(net), loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, i*imgs);
-        if(i%100==0)
+        if(i%100==0 && !rank)
         {
 #ifdef GPU
             if(ngpus != 1) sync_nets(nets, ngpus, 0);
 #endif
             char buff[256];
             sprintf(buff, "%s/%s.backup", backup_directory, base);
-            save_weights(net, buff);
+            save_checkpoint(ckpt, net, buff, 0);
         }
-        if(i%1000==0 || (i < 1000 && i%100 == 0))
+        if((i%1000==0 || (i < 1000 && i%100 == 0)) && !rank)
         {
 #ifdef GPU
             if(ngpus != 1) sync_nets(nets, ngpus, 0);
 #endif
             char buff[256];
             sprintf(buff, "%s/%s_%d.weights", backup_directory, base, i);
-            save_weights(net, buff);
+            save_checkpoint(ckpt, net, buff, 1);
         }
         free_data(train);
     }
@@ -161,7 +176,9 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 #endif
     char buff[256];
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
-    save_weights(net, buff);
+    if(!rank) save_checkpoint(ckpt, net, buff, 0);
+    free_checkpointer(ckpt);
+    if(r) free_ring(r);
 }
 
 
@@ -449,6 +466,8 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     image *buf = calloc(nthreads, sizeof(image));
     image *buf_resized = calloc(nthreads, sizeof(image));
     pthread_t *thr = calloc(nthreads, sizeof(pthread_t));
+    detection **dets = calloc(nthreads, sizeof(detection *));
+    int *nboxes = calloc(nthreads, sizeof(int));
 
     load_args args = {0};
     args.w = net->w;
@@ -476,26 +495,30 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
             args.resized = &buf_resized[t];
             thr[t] = load_data_in_thread(args);
         }
+        int loaded = 0;
         for(t = 0; t < nthreads && i+t-nthreads < m; ++t){
-            char *path = paths[i+t-nthreads];
-            char *id = basecfg(path);
             float *X = val_resized[t].data;
             network_predict(net, X);
+            nboxes[t] = 0;
+            dets[t] = get_network_boxes(net, val[t].w, val[t].h, thresh, .5, map, 0, &nboxes[t]);
+            ++loaded;
+        }
+        /* if (nms) do_nms_sort(dets, nboxes, classes, nms); */
+        if (nms)
+            diounms_sort_batch(dets, nboxes, loaded, classes, nms, iou_kind, nms_kind, loaded);
+        for(t = 0; t < loaded; ++t){
+            char *path = paths[i+t-nthreads];
+            char *id = basecfg(path);
             int w = val[t].w;
             int h = val[t].h;
-            int nboxes = 0;
-            detection *dets = get_network_boxes(net, w, h, thresh, .5, map, 0, &nboxes);
-            /* if (nms) do_nms_sort(dets, nboxes, classes, nms); */
-            if (nms)
-                diounms_sort(dets, nboxes, classes, nms, iou_kind, nms_kind);
             if (coco){
-                print_cocos(fp, path, dets, nboxes, classes, w, h);
+                print_cocos(fp, path, dets[t], nboxes[t], classes, w, h);
             } else if (imagenet){
-                print_imagenet_detections(fp, i+t-nthreads+1, dets, nboxes, classes, w, h);
+                print_imagenet_detections(fp, i+t-nthreads+1, dets[t], nboxes[t], classes, w, h);
             } else {
-                print_detector_detections(fps, id, dets, nboxes, classes, w, h);
+                print_detector_detections(fps, id, dets[t], nboxes[t], classes, w, h);
             }
-            free_detections(dets, nboxes);
+            free_detections(dets[t], nboxes[t]);
             free(id);
             free_image(val[t]);
             free_image(val_resized[t]);
@@ -636,6 +659,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
         detection *dets = get_network_boxes(net, im.w, im.h, thresh, hier_thresh, 0, 1, &nboxes);
         if (nms)
             diounms_sort(dets, nboxes, l.classes, nms, iou_kind, nms_kind);
+        cap_detections(dets, nboxes, l.classes, l.max_detections);
 
 
         Res_t *res = calloc(nboxes, sizeof(Res_t));
@@ -870,7 +894,6 @@ void run_detector(int argc, char **argv)
     float thresh = find_float_arg(argc, argv, "-thresh", .5);
     float hier_thresh = find_float_arg(argc, argv, "-hier", .5);
     int cam_index = find_int_arg(argc, argv, "-c", 0);
-    int frame_skip = find_int_arg(argc, argv, "-s", 0);
     int avg = find_int_arg(argc, argv, "-avg", 3);
     if(argc < 4){
         fprintf(stderr, "usage: %s %s [train/test/valid] [cfg] [weights (optional)]\n", argv[0], argv[1]);
@@ -899,12 +922,29 @@ void run_detector(int argc, char **argv)
         gpus = &gpu;
         ngpus = 1;
     }
+#ifndef GPU
+    int replicas = find_int_arg(argc, argv, "-replicas", 0);
+    if(replicas > 1){
+        gpus = calloc(replicas, sizeof(int));
+        ngpus = replicas;
+    }
+#endif
 
     int clear = find_arg(argc, argv, "-clear");
+    char *ringspec = find_char_arg(argc, argv, "-ring", 0);
+    int rank = find_int_arg(argc, argv, "-rank", 0);
+    int world = find_int_arg(argc, argv, "-world", 1);
+    int keep = find_int_arg(argc, argv, "-keep", 0);
     int fullscreen = find_arg(argc, argv, "-fullscreen");
     int width = find_int_arg(argc, argv, "-w", 0);
     int height = find_int_arg(argc, argv, "-h", 0);
     int fps = find_int_arg(argc, argv, "-fps", 0);
+    int workers = find_int_arg(argc, argv, "-workers", 1);
+    int depth = find_int_arg(argc, argv, "-depth", 3);
+    int drop = find_int_arg(argc, argv, "-drop", -1);
+    int headless = find_arg(argc, argv, "-headless");
+    int frame_skip = find_int_arg(argc, argv, "-s", 0);
+    int batch = find_int_arg(argc, argv, "-batch", 0);
 
     int draw_flag = find_int_arg(argc, argv, "-draw_flag", 0);
     //int class = find_int_arg(argc, argv, "-class", 0);
@@ -914,7 +954,7 @@ void run_detector(int argc, char **argv)
     char *weights = (argc > 5) ? argv[5] : 0;
     char *filename = (argc > 6) ? argv[6]: 0;
     if(0==strcmp(argv[2], "test")) test_detector(datacfg, cfg, weights, filename, thresh, hier_thresh, outfile, fullscreen, draw_flag);
-    else if(0==strcmp(argv[2], "train")) train_detector(datacfg, cfg, weights, gpus, ngpus, clear);
+    else if(0==strcmp(argv[2], "train")) train_detector(datacfg, cfg, weights, gpus, ngpus, clear, ringspec, rank, world, keep);
     else if(0==strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "valid2")) validate_detector_flip(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "recall")) validate_detector_recall(cfg, weights);
@@ -923,7 +963,22 @@ void run_detector(int argc, char **argv)
         int classes = option_find_int(options, "classes", 20);
         char *name_list = option_find_str(options, "names", "data/names.list");
         char **names = get_labels(name_list);
-        demo(cfg, weights, thresh, cam_index, filename, names, classes, frame_skip, prefix, avg, hier_thresh, width, height, fps, fullscreen);
+        if(drop < 0) drop = filename == 0;
+        demo_pipeline(cfg, weights, thresh, cam_index, filename, names, classes, prefix, avg, hier_thresh, width, height, fps, fullscreen, workers, depth, drop, headless, frame_skip);
+    }
+    else if(0==strcmp(argv[2], "streams")) {
+        list *options = read_data_cfg(datacfg);
+        int classes = option_find_int(options, "classes", 20);
+        char *name_list = option_find_str(options, "names", "data/names.list");
+        char **names = get_labels(name_list);
+        if(drop < 0) drop = 1;
+        int nsources = 0;
+        while(6 + nsources < argc && argv[6 + nsources]) ++nsources;
+        if(!nsources){
+            fprintf(stderr, "usage: %s %s streams [data] [cfg] [weights] [source] [source...]\n", argv[0], argv[1]);
+            return;
+        }
+        demo_streams(cfg, weights, thresh, argv + 6, nsources, names, classes, prefix, hier_thresh, batch, depth, drop, headless);
     }
     //else if(0==strcmp(argv[2], "extract")) extract_detector(datacfg, cfg, weights, cam_index, filename, class, thresh, frame_skip);
     //else if(0==strcmp(argv[2], "censor")) censor_detector(datacfg, cfg, weights, cam_index, filename, class, thresh, frame_skip);
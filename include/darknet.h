@@ -129,6 +129,12 @@ typedef struct{
 struct network;
 typedef struct network network;
 
+struct ring;
+typedef struct ring ring;
+
+struct checkpointer;
+typedef struct checkpointer checkpointer;
+
 struct layer;
 typedef struct layer layer;
 
@@ -219,6 +225,9 @@ struct layer{
     int onlyforward;
     int stopbackward;
     int dontload;
+    int skipped;
+    size_t skipped_bytes;
+    int aliased;
     int dontsave;
     int dontloadscales;
     int numload;
@@ -265,6 +274,9 @@ struct layer{
     float cls_normalizer;
     int iou_loss;
     int nms_kind;
+    int pre_nms_topk;
+    int pre_nms_class_topk;
+    int max_detections;
     /* end add */
 
     float * output;
@@ -458,6 +470,7 @@ typedef enum {
 typedef struct network{
     int n;
     int batch;
+    int batch_capacity;
     size_t *seen;
     int *t;
     float epoch;
@@ -515,6 +528,18 @@ typedef struct network{
     float *cost;
     float clip;
 
+    char *cfgfile;
+    void *weights_map;
+    size_t weights_map_size;
+    int shared_weights;
+    ring *ring;
+    int arena;
+    float *param_arena;
+    size_t param_arena_size;
+    float *grad_arena;
+    size_t grad_arena_size;
+    size_t arena_weights;
+
 #ifdef GPU
     float *input_gpu;
     float *truth_gpu;
@@ -572,6 +597,8 @@ typedef struct detection{
     int sort_class;
 } detection;
 
+typedef void (*detection_handler)(detection *det, void *ctx);
+
 typedef struct matrix{
     int rows, cols;
     float **vals;
@@ -632,6 +659,7 @@ typedef struct{
 
 
 network *load_network(char *cfg, char *weights, int clear);
+network *clone_network_shared(network *src, int batch);
 load_args get_base_args(network *net);
 
 void free_data(data d);
@@ -720,6 +748,8 @@ void rgbgr_weights(layer l);
 image *get_weights(layer l);
 
 void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, int frame_skip, char *prefix, int avg, float hier_thresh, int w, int h, int fps, int fullscreen);
+void demo_pipeline(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, char *prefix, int avg, float hier_thresh, int w, int h, int fps, int fullscreen, int workers, int depth, int drop, int headless, int skip);
+void demo_streams(char *cfgfile, char *weightfile, float thresh, char **sources, int nsources, char **names, int classes, char *prefix, float hier_thresh, int batch, int depth, int drop, int headless);
 void get_detection_detections(layer l, int w, int h, float thresh, detection *dets);
 
 char *option_find_str(list *l, char *key, char *def);
@@ -727,15 +757,26 @@ int option_find_int(list *l, char *key, int def);
 int option_find_int_quiet(list *l, char *key, int def);
 
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_batch(char *filename, int batch);
+network *parse_network_cfg_upto(char *filename, int cutoff);
+network *parse_network_cfg_for_output(char *filename, int output);
 void save_weights(network *net, char *filename);
 void load_weights(network *net, char *filename);
 void save_weights_upto(network *net, char *filename, int cutoff);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
+void save_weights_mapped(network *net, char *filename);
+void load_weights_mapped(network *net, char *filename, int start, int cutoff);
+void compile_plan(char *cfgfile, char *weightfile, char *filename);
+network *load_plan(char *filename);
+int is_plan(char *filename);
 
 void zero_objectness(layer l);
 void get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection *dets);
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets);
+int stream_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int relative, detection_handler handler, void *ctx);
+void stream_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection_handler handler, void *ctx);
 void free_network(network *net);
+void pack_network_arena(network *net);
 void set_batch_network(network *net, int b);
 void set_temp_network(network *net, float t);
 image load_image(char *filename, int w, int h, int c);
@@ -797,14 +838,38 @@ int network_height(network *net);
 float *network_predict_image(network *net, image im);
 void network_detect(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets);
 detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+detection *get_network_boxes_batch(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+void stream_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection_handler handler, void *ctx);
+/* make_detections puts the boxes, their class probabilities and their masks
+ * in one allocation, free_detections releases only that block. arrays built
+ * by hand with a prob or mask allocation per box must free those per box
+ * themselves before calling it */
+detection *make_detections(int n, int classes, int coords);
 void free_detections(detection *dets, int n);
 
 void reset_network_state(network *net, int b);
 
+/* everything a recurrent network carries from one step to the next for a
+ * single sequence, so many sequences can share one network */
+typedef struct{
+    int n;
+    float *x;
+} rnn_state;
+
+rnn_state *make_rnn_state(network *net);
+void free_rnn_state(rnn_state *s);
+void save_rnn_state(network *net, int b, rnn_state *s);
+void load_rnn_state(network *net, int b, rnn_state *s);
+float *rnn_step(network *net, rnn_state *s, float *input);
+float *rnn_step_batch(network *net, rnn_state **s, int n, float *input);
+
 char **get_labels(char *filename);
 void do_nms_obj(detection *dets, int total, int classes, float thresh);
 void do_nms_sort(detection *dets, int total, int classes, float thresh);
 void diounms_sort(detection *dets, int total, int classes, float thresh, char *iou_kind, char *nms_kind);
+int topk_detections(detection *dets, int total, int classes, int topk, int class_topk);
+void cap_detections(detection *dets, int total, int classes, int max_dets);
+void diounms_sort_batch(detection **dets, int *nums, int n, int classes, float thresh, char *iou_kind, char *nms_kind, int nthreads);
 
 matrix make_matrix(int rows, int cols);
 
@@ -816,6 +881,14 @@ void make_window(char *name, int w, int h, int fullscreen);
 
 void free_image(image m);
 float train_network(network *net, data d);
+float train_network_replicas(network **nets, int n, data d);
+ring *make_ring(char *spec, int rank, int size);
+void join_ring(network *net, ring *r);
+void free_ring(ring *r);
+checkpointer *make_checkpointer(int keep);
+void save_checkpoint(checkpointer *c, network *net, char *filename, int rotate);
+void free_checkpointer(checkpointer *c);
+int load_optimizer_state(network *net, char *weightfile);
 pthread_t load_data_in_thread(load_args args);
 void load_data_blocking(load_args args);
 list *get_paths(char *filename);
@@ -1,6 +1,12 @@
+/* -Ofast would fold the two step range reduction in exp_approx back into
+ * one multiply and lose about 20 ulp, keep the order as written here */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("no-associative-math")
+#endif
 #include "activations.h"
 
 #include <math.h>
+#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -97,11 +103,188 @@ float activate(float x, ACTIVATION a)
     return 0;
 }
 
+/* the array loops are built for avx512 and avx2 as well and the loader picks
+ * the widest one the cpu has, so the switch runs once per array and the
+ * activation itself is a straight vector loop */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+#define ACTIVATE_LOOP(f) for(i = 0; i < n; ++i) x[i] = f(x[i]); break
+
+SIMD_CLONES
 void activate_array(float *x, const int n, const ACTIVATION a)
 {
     int i;
-    for(i = 0; i < n; ++i){
-        x[i] = activate(x[i], a);
+    switch(a){
+        case LINEAR:
+            break;
+        case LOGISTIC:
+            ACTIVATE_LOOP(logistic_activate);
+        case LOGGY:
+            ACTIVATE_LOOP(loggy_activate);
+        case RELU:
+            ACTIVATE_LOOP(relu_activate);
+        case ELU:
+            ACTIVATE_LOOP(elu_activate);
+        case SELU:
+            ACTIVATE_LOOP(selu_activate);
+        case RELIE:
+            ACTIVATE_LOOP(relie_activate);
+        case RAMP:
+            ACTIVATE_LOOP(ramp_activate);
+        case LEAKY:
+            ACTIVATE_LOOP(leaky_activate);
+        case TANH:
+            ACTIVATE_LOOP(tanh_activate);
+        case PLSE:
+            ACTIVATE_LOOP(plse_activate);
+        case STAIR:
+            ACTIVATE_LOOP(stair_activate);
+        case HARDTAN:
+            ACTIVATE_LOOP(hardtan_activate);
+        case LHTAN:
+            ACTIVATE_LOOP(lhtan_activate);
+    }
+}
+
+#define ADD_ACTIVATE_LOOP(f) for(i = 0; i < n; ++i) out[i] = f(s1*x[i] + s2*y[i]); break
+
+/* out = a(s1*x + s2*y) in one pass, for residual adds */
+SIMD_CLONES
+void add_activate_array(const float *x, float s1, const float *y, float s2, float *out, const int n, const ACTIVATION a)
+{
+    int i;
+    switch(a){
+        case LINEAR:
+            ADD_ACTIVATE_LOOP(linear_activate);
+        case LOGISTIC:
+            ADD_ACTIVATE_LOOP(logistic_activate);
+        case LOGGY:
+            ADD_ACTIVATE_LOOP(loggy_activate);
+        case RELU:
+            ADD_ACTIVATE_LOOP(relu_activate);
+        case ELU:
+            ADD_ACTIVATE_LOOP(elu_activate);
+        case SELU:
+            ADD_ACTIVATE_LOOP(selu_activate);
+        case RELIE:
+            ADD_ACTIVATE_LOOP(relie_activate);
+        case RAMP:
+            ADD_ACTIVATE_LOOP(ramp_activate);
+        case LEAKY:
+            ADD_ACTIVATE_LOOP(leaky_activate);
+        case TANH:
+            ADD_ACTIVATE_LOOP(tanh_activate);
+        case PLSE:
+            ADD_ACTIVATE_LOOP(plse_activate);
+        case STAIR:
+            ADD_ACTIVATE_LOOP(stair_activate);
+        case HARDTAN:
+            ADD_ACTIVATE_LOOP(hardtan_activate);
+        case LHTAN:
+            ADD_ACTIVATE_LOOP(lhtan_activate);
+    }
+}
+
+/* one pass over the gates and the cell of an lstm step, w* and u* are the
+ * hidden and input projections of each gate */
+SIMD_CLONES
+void lstm_gates_cpu(const int n, const float *wf, const float *uf, const float *wi, const float *ui,
+        const float *wg, const float *ug, const float *wo, const float *uo,
+        float *f, float *i, float *g, float *o, float *c, float *h)
+{
+    int k;
+    #pragma omp simd
+    for(k = 0; k < n; ++k){
+        f[k] = logistic_activate(wf[k] + uf[k]);
+        i[k] = logistic_activate(wi[k] + ui[k]);
+        g[k] = tanh_activate(wg[k] + ug[k]);
+        o[k] = logistic_activate(wo[k] + uo[k]);
+        c[k] = f[k]*c[k] + i[k]*g[k];
+        h[k] = o[k]*tanh_activate(c[k]);
+    }
+}
+
+/* update and reset gates of a gru step, forgot is the state the candidate
+ * sees */
+SIMD_CLONES
+void gru_gates_cpu(const int n, const float *uz, const float *wz, const float *ur, const float *wr,
+        const float *state, float *z, float *r, float *forgot)
+{
+    int k;
+    #pragma omp simd
+    for(k = 0; k < n; ++k){
+        z[k] = logistic_activate(uz[k] + wz[k]);
+        r[k] = logistic_activate(ur[k] + wr[k]);
+        forgot[k] = state[k]*r[k];
+    }
+}
+
+/* candidate and new state of a gru step, state takes the output too */
+SIMD_CLONES
+void gru_output_cpu(const int n, const float *uh, const float *wh, const float *z, int tanh,
+        float *h, float *state, float *output)
+{
+    int k;
+    #pragma omp simd
+    for(k = 0; k < n; ++k){
+        h[k] = tanh ? tanh_activate(uh[k] + wh[k]) : logistic_activate(uh[k] + wh[k]);
+        output[k] = z[k]*state[k] + (1-z[k])*h[k];
+        state[k] = output[k];
+    }
+}
+
+/* softmax over n entries for len positions at once, entry j of position i
+ * is at j*stride + i. the entries of a tree group sit one plane apart in the
+ * region layer, so each step is a straight pass over a plane, in chunks that
+ * stay in cache. with len 1 the entries are contiguous instead */
+SIMD_CLONES
+void softmax_planes_cpu(const float *input, int n, int len, int stride, float temp, float *output)
+{
+    int i, j, c;
+    if(len == 1){
+        float largest = -FLT_MAX;
+        float sum = 0;
+        #pragma omp simd reduction(max:largest)
+        for(j = 0; j < n; ++j) largest = input[j] > largest ? input[j] : largest;
+        #pragma omp simd reduction(+:sum)
+        for(j = 0; j < n; ++j){
+            output[j] = exp_approx(input[j]/temp - largest/temp);
+            sum += output[j];
+        }
+        for(j = 0; j < n; ++j) output[j] /= sum;
+        return;
+    }
+    float largest[256];
+    float sum[256];
+    for(c = 0; c < len; c += 256){
+        int m = len - c < 256 ? len - c : 256;
+        const float *in = input + c;
+        float *out = output + c;
+        for(i = 0; i < m; ++i){
+            largest[i] = -FLT_MAX;
+            sum[i] = 0;
+        }
+        for(j = 0; j < n; ++j){
+            const float *x = in + j*stride;
+            for(i = 0; i < m; ++i) largest[i] = x[i] > largest[i] ? x[i] : largest[i];
+        }
+        for(j = 0; j < n; ++j){
+            const float *x = in + j*stride;
+            float *y = out + j*stride;
+            for(i = 0; i < m; ++i){
+                y[i] = exp_approx(x[i]/temp - largest[i]/temp);
+                sum[i] += y[i];
+            }
+        }
+        for(i = 0; i < m; ++i) sum[i] = 1.f/sum[i];
+        for(j = 0; j < n; ++j){
+            float *y = out + j*stride;
+            for(i = 0; i < m; ++i) y[i] *= sum[i];
+        }
     }
 }
 
@@ -140,11 +323,40 @@ float gradient(float x, ACTIVATION a)
     return 0;
 }
 
+#define GRADIENT_LOOP(f) for(i = 0; i < n; ++i) delta[i] *= f(x[i]); break
+
+SIMD_CLONES
 void gradient_array(const float *x, const int n, const ACTIVATION a, float *delta)
 {
     int i;
-    for(i = 0; i < n; ++i){
-        delta[i] *= gradient(x[i], a);
+    switch(a){
+        case LINEAR:
+            break;
+        case LOGISTIC:
+            GRADIENT_LOOP(logistic_gradient);
+        case LOGGY:
+            GRADIENT_LOOP(loggy_gradient);
+        case RELU:
+            GRADIENT_LOOP(relu_gradient);
+        case ELU:
+            GRADIENT_LOOP(elu_gradient);
+        case SELU:
+            GRADIENT_LOOP(selu_gradient);
+        case RELIE:
+            GRADIENT_LOOP(relie_gradient);
+        case RAMP:
+            GRADIENT_LOOP(ramp_gradient);
+        case LEAKY:
+            GRADIENT_LOOP(leaky_gradient);
+        case TANH:
+            GRADIENT_LOOP(tanh_gradient);
+        case PLSE:
+            GRADIENT_LOOP(plse_gradient);
+        case STAIR:
+            GRADIENT_LOOP(stair_gradient);
+        case HARDTAN:
+            GRADIENT_LOOP(hardtan_gradient);
+        case LHTAN:
+            GRADIENT_LOOP(lhtan_gradient);
     }
-} 
-
+}
@@ -11,6 +11,15 @@ float activate(float x, ACTIVATION a);
 float gradient(float x, ACTIVATION a);
 void gradient_array(const float *x, const int n, const ACTIVATION a, float *delta);
 void activate_array(float *x, const int n, const ACTIVATION a);
+void lstm_gates_cpu(const int n, const float *wf, const float *uf, const float *wi, const float *ui,
+        const float *wg, const float *ug, const float *wo, const float *uo,
+        float *f, float *i, float *g, float *o, float *c, float *h);
+void gru_gates_cpu(const int n, const float *uz, const float *wz, const float *ur, const float *wr,
+        const float *state, float *z, float *r, float *forgot);
+void gru_output_cpu(const int n, const float *uh, const float *wh, const float *z, int tanh,
+        float *h, float *state, float *output);
+void softmax_planes_cpu(const float *input, int n, int len, int stride, float temp, float *output);
+void add_activate_array(const float *x, float s1, const float *y, float s2, float *out, const int n, const ACTIVATION a);
 #ifdef GPU
 void activate_array_gpu(float *x, int n, ACTIVATION a);
 void gradient_array_gpu(float *x, int n, ACTIVATION a, float *delta);
@@ -28,16 +37,56 @@ static inline float hardtan_activate(float x)
     if (x > 1) return 1;
     return x;
 }
+
+/* single precision exp without libm so the array loops vectorize. cephes
+ * expf: split off n*ln2 in two parts, degree 5 polynomial on the rest, build
+ * 2^n in the exponent bits. within 1 ulp of exp for x in [-87, 88], inputs
+ * outside are clamped to it so there are no infs or denormals. logistic built
+ * on it stays within 3 ulp and tanh within 2 */
+static inline float exp_approx(float x)
+{
+    union {float f; int i;} s;
+    x = x < -87.f ? -87.f : x;
+    x = x > 88.f ? 88.f : x;
+    float n = floorf(x*1.44269504f + .5f);
+    float r = x - n*.693359375f + n*2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p*r + 1.3981999507e-3f;
+    p = p*r + 8.3334519073e-3f;
+    p = p*r + 4.1665795894e-2f;
+    p = p*r + 1.6666665459e-1f;
+    p = p*r + 5.0000001201e-1f;
+    p = p*r*r + r + 1.f;
+    s.i = ((int)n + 127) << 23;
+    return p*s.f;
+}
+
+/* odd polynomial near 0 where 1 - 2/(e^2x + 1) would cancel, cephes tanhf */
+static inline float tanh_approx(float x)
+{
+    float a = fabsf(x);
+    float z = x*x;
+    float p = -5.70498872745e-3f;
+    p = p*z + 2.06390887954e-2f;
+    p = p*z - 5.37397155531e-2f;
+    p = p*z + 1.33314422036e-1f;
+    p = p*z - 3.33332819422e-1f;
+    float small = p*z*x + x;
+    float big = 1.f - 2.f/(exp_approx(2.f*a) + 1.f);
+    big = x < 0 ? -big : big;
+    return a < .625f ? small : big;
+}
+
 static inline float linear_activate(float x){return x;}
-static inline float logistic_activate(float x){return 1./(1. + exp(-x));}
-static inline float loggy_activate(float x){return 2./(1. + exp(-x)) - 1;}
+static inline float logistic_activate(float x){return 1.f/(1.f + exp_approx(-x));}
+static inline float loggy_activate(float x){return 2.f/(1.f + exp_approx(-x)) - 1.f;}
 static inline float relu_activate(float x){return x*(x>0);}
-static inline float elu_activate(float x){return (x >= 0)*x + (x < 0)*(exp(x)-1);}
-static inline float selu_activate(float x){return (x >= 0)*1.0507*x + (x < 0)*1.0507*1.6732*(exp(x)-1);}
-static inline float relie_activate(float x){return (x>0) ? x : .01*x;}
-static inline float ramp_activate(float x){return x*(x>0)+.1*x;}
-static inline float leaky_activate(float x){return (x>0) ? x : .1*x;}
-static inline float tanh_activate(float x){return (exp(2*x)-1)/(exp(2*x)+1);}
+static inline float elu_activate(float x){return (x >= 0)*x + (x < 0)*(exp_approx(x)-1.f);}
+static inline float selu_activate(float x){return (x >= 0)*1.0507f*x + (x < 0)*1.0507f*1.6732f*(exp_approx(x)-1.f);}
+static inline float relie_activate(float x){return (x>0) ? x : .01f*x;}
+static inline float ramp_activate(float x){return x*(x>0)+.1f*x;}
+static inline float leaky_activate(float x){return (x>0) ? x : .1f*x;}
+static inline float tanh_activate(float x){return tanh_approx(x);}
 static inline float plse_activate(float x)
 {
     if(x < -4) return .01 * (x + 4);
@@ -2,6 +2,7 @@
 #include "batchnorm_layer.h"
 #include "blas.h"
 #include <stdio.h>
+#include <math.h>
 
 layer make_batchnorm_layer(int batch, int w, int h, int c)
 {
@@ -32,6 +33,11 @@ layer make_batchnorm_layer(int batch, int w, int h, int c)
     l.rolling_mean = calloc(c, sizeof(float));
     l.rolling_variance = calloc(c, sizeof(float));
 
+    l.mean_delta = calloc(c, sizeof(float));
+    l.variance_delta = calloc(c, sizeof(float));
+    l.x = calloc(h * w * c * batch, sizeof(float));
+    l.x_norm = calloc(h * w * c * batch, sizeof(float));
+
     l.forward = forward_batchnorm_layer;
     l.backward = backward_batchnorm_layer;
 #ifdef GPU
@@ -132,43 +138,114 @@ void resize_batchnorm_layer(layer *layer, int w, int h)
     fprintf(stderr, "Not implemented\n");
 }
 
-void forward_batchnorm_layer(layer l, network net)
+/* mean and unbiased variance of channel f in one pass, sums are taken
+ * around the first value of the channel so the subtraction at the end does
+ * not cancel, the spatial runs are summed in float and then in double */
+static void channel_stats(const float *x, int batch, int filters, int spatial, int f, float *mean, float *variance)
 {
-    if(l.type == BATCHNORM) copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
-    copy_cpu(l.outputs*l.batch, l.output, 1, l.x, 1);
-    if(net.train){
-        mean_cpu(l.output, l.batch, l.out_c, l.out_h*l.out_w, l.mean);
-        variance_cpu(l.output, l.mean, l.batch, l.out_c, l.out_h*l.out_w, l.variance);
-
-        scal_cpu(l.out_c, .99, l.rolling_mean, 1);
-        axpy_cpu(l.out_c, .01, l.mean, 1, l.rolling_mean, 1);
-        scal_cpu(l.out_c, .99, l.rolling_variance, 1);
-        axpy_cpu(l.out_c, .01, l.variance, 1, l.rolling_variance, 1);
-
-        normalize_cpu(l.output, l.mean, l.variance, l.batch, l.out_c, l.out_h*l.out_w);   
-        copy_cpu(l.outputs*l.batch, l.output, 1, l.x_norm, 1);
-    } else {
-        normalize_cpu(l.output, l.rolling_mean, l.rolling_variance, l.batch, l.out_c, l.out_h*l.out_w);
+    int b, i;
+    float shift = x[f*spatial];
+    double s1 = 0, s2 = 0;
+    for(b = 0; b < batch; ++b){
+        const float *p = x + (b*filters + f)*spatial;
+        float a1 = 0, a2 = 0;
+        for(i = 0; i < spatial; ++i){
+            float d = p[i] - shift;
+            a1 += d;
+            a2 += d*d;
+        }
+        s1 += a1;
+        s2 += a2;
     }
-    scale_bias(l.output, l.scales, l.batch, l.out_c, l.out_h*l.out_w);
-    add_bias(l.output, l.biases, l.batch, l.out_c, l.out_h*l.out_w);
+    int n = batch*spatial;
+    *mean = shift + s1/n;
+    *variance = (s2 - s1*s1/n)/(n - 1);
 }
 
-void backward_batchnorm_layer(layer l, network net)
+/* normalize, scale and shift in one pass. x may be the output itself, the
+ * input is kept in keep and the normalized values in norm when they are
+ * given */
+static void channel_normalize(const float *x, int batch, int filters, int spatial, int f, float mean, float variance,
+        float scale, float bias, float *keep, float *norm, float *out)
 {
-    if(!net.train){
-        l.mean = l.rolling_mean;
-        l.variance = l.rolling_variance;
+    int b, i;
+    float inv = 1.f/(sqrtf(variance) + .000001f);
+    for(b = 0; b < batch; ++b){
+        int o = (b*filters + f)*spatial;
+        for(i = 0; i < spatial; ++i){
+            float v = x[o + i];
+            float n = (v - mean)*inv;
+            if(keep) keep[o + i] = v;
+            if(norm) norm[o + i] = n;
+            out[o + i] = n*scale + bias;
+        }
     }
-    backward_bias(l.bias_updates, l.delta, l.batch, l.out_c, l.out_w*l.out_h);
-    backward_scale_cpu(l.x_norm, l.delta, l.batch, l.out_c, l.out_w*l.out_h, l.scale_updates);
+}
 
-    scale_bias(l.delta, l.scales, l.batch, l.out_c, l.out_h*l.out_w);
+void forward_batchnorm_layer(layer l, network net)
+{
+    int f;
+    int spatial = l.out_h*l.out_w;
+    float *x = (l.type == BATCHNORM) ? net.input : l.output;
+    #pragma omp parallel for if(l.outputs*l.batch > 65536)
+    for(f = 0; f < l.out_c; ++f){
+        if(net.train){
+            channel_stats(x, l.batch, l.out_c, spatial, f, l.mean + f, l.variance + f);
+            l.rolling_mean[f] = .99*l.rolling_mean[f] + .01*l.mean[f];
+            l.rolling_variance[f] = .99*l.rolling_variance[f] + .01*l.variance[f];
+            channel_normalize(x, l.batch, l.out_c, spatial, f, l.mean[f], l.variance[f],
+                    l.scales[f], l.biases[f], l.x, l.x_norm, l.output);
+        } else {
+            channel_normalize(x, l.batch, l.out_c, spatial, f, l.rolling_mean[f], l.rolling_variance[f],
+                    l.scales[f], l.biases[f], l.x, 0, l.output);
+        }
+    }
+}
 
-    mean_delta_cpu(l.delta, l.variance, l.batch, l.out_c, l.out_w*l.out_h, l.mean_delta);
-    variance_delta_cpu(l.x, l.delta, l.mean, l.variance, l.batch, l.out_c, l.out_w*l.out_h, l.variance_delta);
-    normalize_delta_cpu(l.x, l.mean, l.variance, l.mean_delta, l.variance_delta, l.batch, l.out_c, l.out_w*l.out_h, l.delta);
-    if(l.type == BATCHNORM) copy_cpu(l.outputs*l.batch, l.delta, 1, net.delta, 1);
+/* bias, scale, mean and variance gradients of a channel come from the same
+ * three sums over its delta, so backward reads the channel twice: once for
+ * the sums and once to write the input delta */
+void backward_batchnorm_layer(layer l, network net)
+{
+    int f;
+    int spatial = l.out_w*l.out_h;
+    int n = l.batch*spatial;
+    float *mean = net.train ? l.mean : l.rolling_mean;
+    float *variance = net.train ? l.variance : l.rolling_variance;
+    float *out = (l.type == BATCHNORM) ? net.delta : 0;
+    #pragma omp parallel for if(l.outputs*l.batch > 65536)
+    for(f = 0; f < l.out_c; ++f){
+        int b, i;
+        float m = mean[f];
+        float sd = 0, sdn = 0, sdx = 0;
+        for(b = 0; b < l.batch; ++b){
+            int o = (b*l.out_c + f)*spatial;
+            for(i = 0; i < spatial; ++i){
+                float d = l.delta[o + i];
+                sd += d;
+                sdn += d*l.x_norm[o + i];
+                sdx += d*(l.x[o + i] - m);
+            }
+        }
+        l.bias_updates[f] += sd;
+        l.scale_updates[f] += sdn;
+
+        float scale = l.scales[f];
+        l.mean_delta[f] = scale*sd*(-1./sqrt(variance[f] + .00001f));
+        l.variance_delta[f] = scale*sdx*(-.5*pow(variance[f] + .00001f, (float)(-3./2.)));
+
+        float inv = scale/sqrt(variance[f] + .00001f);
+        float dv = l.variance_delta[f]*2./n;
+        float dm = l.mean_delta[f]/n;
+        for(b = 0; b < l.batch; ++b){
+            int o = (b*l.out_c + f)*spatial;
+            for(i = 0; i < spatial; ++i){
+                float d = l.delta[o + i]*inv + dv*(l.x[o + i] - m) + dm;
+                l.delta[o + i] = d;
+                if(out) out[o + i] = d;
+            }
+        }
+    }
 }
 
 #ifdef GPU
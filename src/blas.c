@@ -182,6 +182,36 @@ void axpy_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY)
         Y[i*INCY] += ALPHA*X[i*INCX];
 }
 
+/* the decay, step and momentum of an sgd update in one sweep over the
+ * parameters, it does the arithmetic of axpy, axpy, scal without reading
+ * the buffers three times. decay is already scaled by the batch */
+void sgd_update_cpu(int n, float *w, float *d, float rate, float decay, float momentum)
+{
+    int i;
+    #pragma omp parallel for if(n > 65536)
+    for(i = 0; i < n; ++i){
+        float g = d[i] - decay*w[i];
+        w[i] += rate*g;
+        d[i] = momentum*g;
+    }
+}
+
+/* adam_update_gpu in one sweep */
+void adam_update_cpu(float *w, float *d, float *m, float *v, float B1, float B2, float eps, float decay, float rate, int n, int batch, int t)
+{
+    int i;
+    float c1 = 1.f/(1.f - powf(B1, t));
+    float c2 = 1.f/(1.f - powf(B2, t));
+    #pragma omp parallel for if(n > 65536)
+    for(i = 0; i < n; ++i){
+        float g = d[i] - decay*batch*w[i];
+        m[i] = B1*m[i] + (1-B1)*g;
+        v[i] = B2*v[i] + (1-B2)*g*g;
+        w[i] += rate*(m[i]*c1)/(sqrtf(v[i]*c2) + eps);
+        d[i] = 0;
+    }
+}
+
 void scal_cpu(int N, float ALPHA, float *X, int INCX)
 {
     int i;
@@ -342,6 +372,17 @@ void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, i
 void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out)
 {
     int i, j, k, b;
+    if(forward){
+        /* build each output row once, the other stride-1 rows are copies */
+        int ow = w*stride;
+        for(j = 0; j < batch*c*h; ++j){
+            float *src = in + j*w;
+            float *dst = out + j*ow*stride;
+            for(i = 0; i < ow; ++i) dst[i] = scale*src[i/stride];
+            for(k = 1; k < stride; ++k) memcpy(dst + k*ow, dst, ow*sizeof(float));
+        }
+        return;
+    }
     for(b = 0; b < batch; ++b){
         for(k = 0; k < c; ++k){
             for(j = 0; j < h*stride; ++j){
@@ -104,10 +104,133 @@ void do_nms_sort(detection *dets, int total, int classes, float thresh)
     }
 }
 
+static float nms_overlap(box a, box b, int use_diou)
+{
+    return use_diou ? box_diou(a, b) : box_iou(a, b);
+}
+
+int nms_max_comparator(const void *pa, const void *pb)
+{
+    detection a = *(detection *)pa;
+    detection b = *(detection *)pb;
+    float diff = a.prob[a.sort_class] - b.prob[b.sort_class];
+    if(diff < 0) return 1;
+    else if(diff > 0) return -1;
+    return 0;
+}
+
+/* class-agnostic greedy nms: a box suppresses every lower scoring box that
+ * overlaps it, whatever class that box predicts */
+static void agnostic_nms(detection *dets, int total, int classes, float thresh, int use_diou)
+{
+    int i, j, k;
+    for(i = 0; i < total; ++i)
+    {
+        dets[i].sort_class = max_index(dets[i].prob, classes);
+    }
+    qsort(dets, total, sizeof(detection), nms_max_comparator);
+    for(i = 0; i < total; ++i)
+    {
+        if(dets[i].prob[dets[i].sort_class] == 0)
+            continue;
+        box a = dets[i].bbox;
+        for(j = i+1; j < total; ++j)
+        {
+            if(dets[j].prob[dets[j].sort_class] == 0)
+                continue;
+            if (nms_overlap(a, dets[j].bbox, use_diou) > thresh)
+            {
+                for(k = 0; k < classes; ++k)
+                {
+                    dets[j].prob[k] = 0;
+                }
+            }
+        }
+    }
+}
+
+/* matrix nms (SOLOv2): every score is decayed by its overlap with all higher
+ * scoring boxes at once, so there is no sequential dependency between boxes.
+ * uses the same gaussian kernel as softnms */
+static void matrix_nms(detection *dets, int total, int classes, int use_diou)
+{
+    int i, j, k;
+    size_t size = 0;
+    float *iou = 0;
+    float *compensate = calloc(total, sizeof(float));
+    float *decay = calloc(total, sizeof(float));
+
+    for(k = 0; k < classes; ++k)
+    {
+        for(i = 0; i < total; ++i)
+        {
+            dets[i].sort_class = k;
+        }
+        qsort(dets, total, sizeof(detection), nms_comparator);
+        int n = 0;
+        while(n < total && dets[n].prob[k] > 0) ++n;
+        if(n < 2) continue;
+        /* only the boxes that score in this class, grown as needed */
+        if((size_t)n*n > size){
+            size = (size_t)n*n;
+            free(iou);
+            iou = calloc(size, sizeof(float));
+        }
+
+        #pragma omp parallel for private(i)
+        for(j = 1; j < n; ++j)
+        {
+            for(i = 0; i < j; ++i)
+            {
+                float o = nms_overlap(dets[i].bbox, dets[j].bbox, use_diou);
+                iou[(size_t)i*n + j] = o > 0 ? o : 0;
+            }
+        }
+        compensate[0] = 0;
+        #pragma omp parallel for private(j)
+        for(i = 1; i < n; ++i)
+        {
+            float m = 0;
+            for(j = 0; j < i; ++j)
+            {
+                if(iou[(size_t)j*n + i] > m) m = iou[(size_t)j*n + i];
+            }
+            compensate[i] = m;
+        }
+        #pragma omp parallel for private(i)
+        for(j = 1; j < n; ++j)
+        {
+            float d = 1;
+            for(i = 0; i < j; ++i)
+            {
+                float o = iou[(size_t)i*n + j];
+                float f = exp(-(o*o - compensate[i]*compensate[i]));
+                if(f < d) d = f;
+            }
+            decay[j] = d;
+        }
+        for(j = 1; j < n; ++j)
+        {
+            dets[j].prob[k] *= decay[j];
+        }
+    }
+    free(iou);
+    free(compensate);
+    free(decay);
+}
+
 void diounms_sort(detection *dets, int total, int classes, float thresh, char *iou_kind, char *nms_kind)
 {
     int i, j, k;
     float factor = .0;
+    if(strcmp(iou_kind, "iou") && strcmp(iou_kind, "diou")){
+        fprintf(stderr, "Unknown iou_kind %s, expected iou or diou\n", iou_kind);
+        error("Bad nms options");
+    }
+    if(strcmp(nms_kind, "greedynms") && strcmp(nms_kind, "softnms") && strcmp(nms_kind, "agnosticnms") && strcmp(nms_kind, "matrixnms")){
+        fprintf(stderr, "Unknown nms_kind %s, expected greedynms, softnms, agnosticnms or matrixnms\n", nms_kind);
+        error("Bad nms options");
+    }
     k = total-1;
     for(i = 0; i <= k; ++i)
     {
@@ -122,6 +245,19 @@ void diounms_sort(detection *dets, int total, int classes, float thresh, char *i
     }
     total = k+1;
 
+    int use_diou = strcmp(iou_kind, "diou") == 0;
+    if (strcmp(nms_kind, "agnosticnms") == 0)
+    {
+        agnostic_nms(dets, total, classes, thresh, use_diou);
+        return;
+    }
+    if (strcmp(nms_kind, "matrixnms") == 0)
+    {
+        matrix_nms(dets, total, classes, use_diou);
+        return;
+    }
+    int soft = strcmp(nms_kind, "softnms") == 0;
+
     for(k = 0; k < classes; ++k)
     {
         for(i = 0; i < total; ++i)
@@ -137,55 +273,205 @@ void diounms_sort(detection *dets, int total, int classes, float thresh, char *i
             for(j = i+1; j < total; ++j)
             {
                 box b = dets[j].bbox;
+                float o = nms_overlap(a, b, use_diou);
 
-                if (strcmp(nms_kind, "greedynms") == 0)
+                if (soft)
                 {
-                    if (strcmp(iou_kind, "iou") == 0)
-                    {
-                        if (box_iou(a, b) > thresh)
-                        {
-                            dets[j].prob[k] = 0;
-                        }
-                    }
-                    else if (strcmp(iou_kind, "diou") == 0)
-                    {
-                        if (box_diou(a, b) > thresh)
-                        {
-                            dets[j].prob[k] = 0;
-                        }
-                    }
+                    factor = -1 * o * o / 1;
+                    factor = pow(e, factor);
+                    dets[j].prob[k] *= factor;
                 }
-                else if (strcmp(nms_kind, "softnms") == 0)
+                else if (o > thresh)
                 {
-                    if (strcmp(iou_kind, "iou") == 0)
-                    {
-                        factor = -1 * box_iou(a, b) * box_iou(a, b) / 1;
-                        factor = pow(e, factor);
-                        dets[j].prob[k] *= factor;
-                    }
-                    else if (strcmp(iou_kind, "diou") == 0)
-                    {
-                        factor = -1 * box_diou(a, b) * box_diou(a, b) / 1;
-                        factor = pow(e, factor);
-                        dets[j].prob[k] *= factor;
-                    }
+                    dets[j].prob[k] = 0;
                 }
+            }
+        }
+    }
+}
 
-                /* if (box_iou(a, b) > thresh && strcmp(nms_kind, "greedynms") == 0) */
-                /* { */
-                /*     dets[j].prob[k] = 0; */
-                /* } */
-                /* else */
-                /* { */
-                /*     if (box_diou(a, b) > thresh && strcmp(nms_kind, "diounms") == 0) */
-                /*     { */
-                /*         dets[j].prob[k] = 0; */
-                /*     } */
-                /* } */
+typedef struct{
+    detection **dets;
+    int *nums;
+    int n;
+    int offset;
+    int stride;
+    int classes;
+    float thresh;
+    char *iou_kind;
+    char *nms_kind;
+} nms_args;
 
+void *diounms_sort_thread(void *ptr)
+{
+    nms_args args = *(nms_args*)ptr;
+    free(ptr);
+    int i;
+    for(i = args.offset; i < args.n; i += args.stride)
+    {
+        diounms_sort(args.dets[i], args.nums[i], args.classes, args.thresh, args.iou_kind, args.nms_kind);
+    }
+    return 0;
+}
+
+/* runs diounms_sort over the detections of n images using up to nthreads
+ * threads (one per image if nthreads <= 0) */
+void diounms_sort_batch(detection **dets, int *nums, int n, int classes, float thresh, char *iou_kind, char *nms_kind, int nthreads)
+{
+    int t;
+    if(nthreads <= 0 || nthreads > n) nthreads = n;
+    if(nthreads <= 1)
+    {
+        for(t = 0; t < n; ++t) diounms_sort(dets[t], nums[t], classes, thresh, iou_kind, nms_kind);
+        return;
+    }
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    for(t = 0; t < nthreads; ++t)
+    {
+        nms_args *ptr = calloc(1, sizeof(nms_args));
+        ptr->dets = dets;
+        ptr->nums = nums;
+        ptr->n = n;
+        ptr->offset = t;
+        ptr->stride = nthreads;
+        ptr->classes = classes;
+        ptr->thresh = thresh;
+        ptr->iou_kind = iou_kind;
+        ptr->nms_kind = nms_kind;
+        if(pthread_create(&threads[t], 0, diounms_sort_thread, ptr)) error("Thread creation failed");
+    }
+    for(t = 0; t < nthreads; ++t)
+    {
+        pthread_join(threads[t], 0);
+    }
+    free(threads);
+}
+
+/* partial quickselect (nth_element): afterwards a[0..k-1] hold the k largest
+ * values in no particular order. returns the k-th largest */
+float select_kth_largest(float *a, int n, int k)
+{
+    int lo = 0;
+    int hi = n - 1;
+    while(lo < hi){
+        float pivot = a[(lo + hi)/2];
+        int i = lo;
+        int j = hi;
+        while(i <= j){
+            while(a[i] > pivot) ++i;
+            while(a[j] < pivot) --j;
+            if(i <= j){
+                float swap = a[i];
+                a[i] = a[j];
+                a[j] = swap;
+                ++i;
+                --j;
             }
         }
+        if(k-1 <= j) hi = j;
+        else if(k-1 >= i) lo = i;
+        else break;
+    }
+    return a[k-1];
+}
+
+/* keeps the k largest of n scores by zeroing the rest, exact on ties */
+static void keep_topk_scores(float **scores, int n, int k, float *buf)
+{
+    int i;
+    if(k <= 0 || n <= k) return;
+    for(i = 0; i < n; ++i) buf[i] = *scores[i];
+    float v = select_kth_largest(buf, n, k);
+    int quota = k;
+    for(i = 0; i < n; ++i) if(*scores[i] > v) --quota;
+    for(i = 0; i < n; ++i){
+        if(*scores[i] > v) continue;
+        if(*scores[i] == v && quota > 0) --quota;
+        else *scores[i] = 0;
+    }
+}
+
+/* bounds the nms input: keeps at most class_topk boxes per class and topk
+ * boxes overall (ranked by their best class), moves the survivors to the
+ * front and returns how many there are. 0 disables either limit */
+int topk_detections(detection *dets, int total, int classes, int topk, int class_topk)
+{
+    int i, k;
+    if(class_topk > 0){
+        float **scores = calloc(total, sizeof(float *));
+        float *buf = calloc(total, sizeof(float));
+        for(k = 0; k < classes; ++k){
+            int n = 0;
+            for(i = 0; i < total; ++i){
+                if(dets[i].prob[k] > 0) scores[n++] = dets[i].prob + k;
+            }
+            keep_topk_scores(scores, n, class_topk, buf);
+        }
+        free(scores);
+        free(buf);
+        for(i = 0; i < total; ++i){
+            dets[i].sort_class = max_index(dets[i].prob, classes);
+            if(dets[i].prob[dets[i].sort_class] == 0) dets[i].objectness = 0;
+        }
+    }
+
+    k = 0;
+    for(i = 0; i < total; ++i){
+        if(dets[i].objectness == 0) continue;
+        detection swap = dets[i];
+        dets[i] = dets[k];
+        dets[k] = swap;
+        ++k;
+    }
+    total = k;
+
+    if(topk > 0 && total > topk){
+        float *best = calloc(total, sizeof(float));
+        for(i = 0; i < total; ++i){
+            best[i] = dets[i].prob[max_index(dets[i].prob, classes)];
+        }
+        float v = select_kth_largest(best, total, topk);
+        k = 0;
+        for(i = 0; i < total && k < topk; ++i){
+            if(dets[i].prob[max_index(dets[i].prob, classes)] <= v) continue;
+            detection swap = dets[i];
+            dets[i] = dets[k];
+            dets[k] = swap;
+            ++k;
+        }
+        for(i = k; i < total && k < topk; ++i){
+            if(dets[i].prob[max_index(dets[i].prob, classes)] != v) continue;
+            detection swap = dets[i];
+            dets[i] = dets[k];
+            dets[k] = swap;
+            ++k;
+        }
+        for(i = topk; i < total; ++i){
+            dets[i].objectness = 0;
+            memset(dets[i].prob, 0, classes*sizeof(float));
+        }
+        free(best);
+        total = topk;
+    }
+    return total;
+}
+
+/* post-nms cap: keeps only the max_dets highest (box, class) scores */
+void cap_detections(detection *dets, int total, int classes, int max_dets)
+{
+    int i, k;
+    if(max_dets <= 0) return;
+    int n = 0;
+    float **scores = calloc(total*classes, sizeof(float *));
+    for(i = 0; i < total; ++i){
+        for(k = 0; k < classes; ++k){
+            if(dets[i].prob[k] > 0) scores[n++] = dets[i].prob + k;
+        }
     }
+    float *buf = calloc(n, sizeof(float));
+    keep_topk_scores(scores, n, max_dets, buf);
+    free(scores);
+    free(buf);
 }
 
 box float_to_box(float *f, int stride)
@@ -10,5 +10,6 @@ float box_rmse(box a, box b);
 dbox diou(box a, box b);
 box decode_box(box b, box anchor);
 box encode_box(box b, box anchor);
+float select_kth_largest(float *a, int n, int k);
 
 #endif
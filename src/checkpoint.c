@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "parser.h"
+#include "utils.h"
+
+/* checkpoints written off the training thread. saving only serializes the
+ * weights and the optimizer state into memory, a writer thread puts them on
+ * disk through a temporary file and a rename, so a crash mid-write leaves
+ * the previous checkpoint intact. the .state file lands before the weights,
+ * a checkpoint whose weights exist is complete */
+
+/* path with suffix appended, sized from the path so it is never cut short */
+static char *suffixed_path(char *path, char *suffix)
+{
+    char *s = calloc(strlen(path) + strlen(suffix) + 1, 1);
+    sprintf(s, "%s%s", path, suffix);
+    return s;
+}
+
+static int write_atomic(char *path, char *buf, size_t size)
+{
+    char *tmp = suffixed_path(path, ".tmp");
+    FILE *fp = fopen(tmp, "wb");
+    if(!fp){
+        free(tmp);
+        return 0;
+    }
+    int ok = fwrite(buf, 1, size, fp) == size;
+    ok = !fflush(fp) && ok;
+    ok = !fsync(fileno(fp)) && ok;
+    ok = !fclose(fp) && ok;
+    if(ok && !rename(tmp, path)){
+        free(tmp);
+        return 1;
+    }
+    unlink(tmp);
+    free(tmp);
+    return 0;
+}
+
+static void remove_checkpoint(char *path)
+{
+    char *state = suffixed_path(path, ".state");
+    unlink(path);
+    unlink(state);
+    free(state);
+}
+
+static void write_checkpoint(checkpointer *c, checkpoint_job *job)
+{
+    int i;
+    char *state = suffixed_path(job->path, ".state");
+    int ok = write_atomic(state, job->state, job->state_size) && write_atomic(job->path, job->weights, job->weights_size);
+    free(state);
+    if(!ok){
+        fprintf(stderr, "Couldn't write checkpoint %s\n", job->path);
+        return;
+    }
+    if(!job->rotate || c->keep <= 0) return;
+    for(i = 0; i < c->nkept; ++i){
+        if(!strcmp(c->kept[i], job->path)) return;
+    }
+    if(c->nkept == c->keep){
+        remove_checkpoint(c->kept[0]);
+        free(c->kept[0]);
+        memmove(c->kept, c->kept + 1, (c->nkept - 1)*sizeof(char *));
+        --c->nkept;
+    }
+    c->kept[c->nkept++] = copy_string(job->path);
+}
+
+static void *checkpoint_thread(void *ptr)
+{
+    checkpointer *c = (checkpointer *)ptr;
+    while(1){
+        checkpoint_job *job = queue_pop(c->jobs);
+        if(!job) break;
+        write_checkpoint(c, job);
+        free(job->path);
+        free(job->weights);
+        free(job->state);
+        free(job);
+    }
+    return 0;
+}
+
+/* keep is how many of the rotating checkpoints stay on disk, 0 keeps all */
+checkpointer *make_checkpointer(int keep)
+{
+    checkpointer *c = calloc(1, sizeof(checkpointer));
+    c->keep = keep;
+    if(keep > 0) c->kept = calloc(keep, sizeof(char *));
+    c->jobs = make_queue(16);
+    if(pthread_create(&c->thread, 0, checkpoint_thread, c)) error("Thread creation failed");
+    return c;
+}
+
+/* snapshots net and queues it for filename. rotating checkpoints count
+ * against keep, the oldest goes once there are more */
+void save_checkpoint(checkpointer *c, network *net, char *filename, int rotate)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        cuda_set_device(net->gpu_index);
+    }
+#endif
+    fprintf(stderr, "Checkpointing to %s\n", filename);
+    checkpoint_job *job = calloc(1, sizeof(checkpoint_job));
+    job->path = copy_string(filename);
+    job->rotate = rotate;
+    FILE *fp = open_memstream(&job->weights, &job->weights_size);
+    if(!fp) error("Couldn't snapshot the network");
+    write_weights_upto(net, fp, net->n);
+    fclose(fp);
+    fp = open_memstream(&job->state, &job->state_size);
+    if(!fp) error("Couldn't snapshot the network");
+    write_optimizer_state(net, fp);
+    fclose(fp);
+    queue_push(c->jobs, job);
+}
+
+/* waits for the queued checkpoints to reach the disk */
+void free_checkpointer(checkpointer *c)
+{
+    int i;
+    queue_push(c->jobs, 0);
+    pthread_join(c->thread, 0);
+    free_queue(c->jobs);
+    for(i = 0; i < c->nkept; ++i) free(c->kept[i]);
+    free(c->kept);
+    free(c);
+}
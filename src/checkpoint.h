@@ -0,0 +1,23 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include "darknet.h"
+#include "queue.h"
+
+typedef struct{
+    char *path;
+    char *weights;
+    size_t weights_size;
+    char *state;
+    size_t state_size;
+    int rotate;
+} checkpoint_job;
+
+struct checkpointer{
+    int keep;
+    char **kept;
+    int nkept;
+    queue *jobs;
+    pthread_t thread;
+};
+
+#endif
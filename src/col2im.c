@@ -15,25 +15,59 @@ void col2im_cpu(float* data_col,
          int channels,  int height,  int width,
          int ksize,  int stride, int pad, float* data_im) 
 {
-    int c,h,w;
+    int c_im;
     int height_col = (height + 2*pad - ksize) / stride + 1;
     int width_col = (width + 2*pad - ksize) / stride + 1;
 
+    /* the ksize*ksize rows of a channel only ever add into that channel's
+     * plane, so channels are split across threads and nothing is shared */
+    #pragma omp parallel for
+    for (c_im = 0; c_im < channels; ++c_im) {
+        int c, h, w;
+        for (c = c_im * ksize * ksize; c < (c_im + 1) * ksize * ksize; ++c) {
+            int w_offset = c % ksize;
+            int h_offset = (c / ksize) % ksize;
+            /* columns that land inside the image, clipped once per row of
+             * the column buffer instead of checked per pixel */
+            int w_start = pad > w_offset ? (pad - w_offset + stride - 1) / stride : 0;
+            int w_end = width - 1 + pad - w_offset < 0 ? 0 : (width - 1 + pad - w_offset) / stride + 1;
+            if (w_end > width_col) w_end = width_col;
+            for (h = 0; h < height_col; ++h) {
+                int im_row = h_offset + h * stride - pad;
+                if (im_row < 0 || im_row >= height) continue;
+                float *col = data_col + (c * height_col + h) * width_col;
+                float *im = data_im + (c_im * height + im_row) * width;
+                for (w = w_start; w < w_end; ++w) {
+                    im[w_offset + w * stride - pad] += col[w];
+                }
+            }
+        }
+    }
+}
+
+/* adds rows laid out as by im2row_cpu back into the image. each channel only
+ * takes from its own slice of the rows, so channels run in parallel */
+void row2im_cpu(float* data_row,
+         int channels,  int height,  int width,
+         int ksize,  int stride, int pad, float* data_im)
+{
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
     int channels_col = channels * ksize * ksize;
-    for (c = 0; c < channels_col; ++c) {
-        int w_offset = c % ksize;
-        int h_offset = (c / ksize) % ksize;
-        int c_im = c / ksize / ksize;
+    int c;
+    #pragma omp parallel for
+    for (c = 0; c < channels; ++c) {
+        int h, w, i, j;
         for (h = 0; h < height_col; ++h) {
             for (w = 0; w < width_col; ++w) {
-                int im_row = h_offset + h * stride;
-                int im_col = w_offset + w * stride;
-                int col_index = (c * height_col + h) * width_col + w;
-                double val = data_col[col_index];
-                col2im_add_pixel(data_im, height, width, channels,
-                        im_row, im_col, c_im, pad, val);
+                float *row = data_row + (h * width_col + w) * channels_col + c * ksize * ksize;
+                for (j = 0; j < ksize; ++j) {
+                    for (i = 0; i < ksize; ++i) {
+                        col2im_add_pixel(data_im, height, width, channels,
+                                h * stride + j, w * stride + i, c, pad, row[j * ksize + i]);
+                    }
+                }
             }
         }
     }
 }
-
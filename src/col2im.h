@@ -4,6 +4,9 @@
 void col2im_cpu(float* data_col,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_im);
+void row2im_cpu(float* data_row,
+        int channels, int height, int width,
+        int ksize, int stride, int pad, float* data_im);
 
 #ifdef GPU
 void col2im_gpu(float *data_col,
@@ -11,7 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam)
+layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam, int init)
 {
     int i;
     layer l = {0};
@@ -44,7 +44,7 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
 
     //float scale = 1./sqrt(inputs);
     float scale = sqrt(2./inputs);
-    for(i = 0; i < outputs*inputs; ++i){
+    for(i = 0; i < outputs*inputs && init; ++i){
         l.weights[i] = scale*rand_uniform(-1, 1);
     }
 
@@ -135,17 +135,20 @@ void update_connected_layer(layer l, update_args a)
     float momentum = a.momentum;
     float decay = a.decay;
     int batch = a.batch;
-    axpy_cpu(l.outputs, learning_rate/batch, l.bias_updates, 1, l.biases, 1);
-    scal_cpu(l.outputs, momentum, l.bias_updates, 1);
+    if(a.adam && l.m){
+        adam_update_cpu(l.weights, l.weight_updates, l.m, l.v, a.B1, a.B2, a.eps, decay, learning_rate, l.inputs*l.outputs, batch, a.t);
+        adam_update_cpu(l.biases, l.bias_updates, l.bias_m, l.bias_v, a.B1, a.B2, a.eps, decay, learning_rate, l.outputs, batch, a.t);
+        if(l.batch_normalize){
+            adam_update_cpu(l.scales, l.scale_updates, l.scale_m, l.scale_v, a.B1, a.B2, a.eps, decay, learning_rate, l.outputs, batch, a.t);
+        }
+        return;
+    }
 
+    sgd_update_cpu(l.outputs, l.biases, l.bias_updates, learning_rate/batch, 0, momentum);
     if(l.batch_normalize){
-        axpy_cpu(l.outputs, learning_rate/batch, l.scale_updates, 1, l.scales, 1);
-        scal_cpu(l.outputs, momentum, l.scale_updates, 1);
+        sgd_update_cpu(l.outputs, l.scales, l.scale_updates, learning_rate/batch, 0, momentum);
     }
-
-    axpy_cpu(l.inputs*l.outputs, -decay*batch, l.weights, 1, l.weight_updates, 1);
-    axpy_cpu(l.inputs*l.outputs, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
-    scal_cpu(l.inputs*l.outputs, momentum, l.weight_updates, 1);
+    sgd_update_cpu(l.inputs*l.outputs, l.weights, l.weight_updates, learning_rate/batch, decay*batch, momentum);
 }
 
 void forward_connected_layer(layer l, network net)
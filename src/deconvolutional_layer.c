@@ -32,7 +32,7 @@ void bilinear_init(layer l)
 }
 
 
-layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int adam)
+layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int adam, int init)
 {
     int i;
     layer l = {0};
@@ -57,7 +57,7 @@ layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size
     //float scale = n/(size*size*c);
     //printf("scale: %f\n", scale);
     float scale = .02;
-    for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_normal();
+    for(i = 0; i < c*n*size*size && init; ++i) l.weights[i] = scale*rand_normal();
     //bilinear_init(l);
     for(i = 0; i < n; ++i){
         l.biases[i] = 0;
@@ -295,17 +295,20 @@ void update_deconvolutional_layer(layer l, update_args a)
     int batch = a.batch;
 
     int size = l.size*l.size*l.c*l.n;
-    axpy_cpu(l.n, learning_rate/batch, l.bias_updates, 1, l.biases, 1);
-    scal_cpu(l.n, momentum, l.bias_updates, 1);
+    if(a.adam && l.m){
+        adam_update_cpu(l.weights, l.weight_updates, l.m, l.v, a.B1, a.B2, a.eps, decay, learning_rate, size, batch, a.t);
+        adam_update_cpu(l.biases, l.bias_updates, l.bias_m, l.bias_v, a.B1, a.B2, a.eps, decay, learning_rate, l.n, batch, a.t);
+        if(l.scales){
+            adam_update_cpu(l.scales, l.scale_updates, l.scale_m, l.scale_v, a.B1, a.B2, a.eps, decay, learning_rate, l.n, batch, a.t);
+        }
+        return;
+    }
 
+    sgd_update_cpu(l.n, l.biases, l.bias_updates, learning_rate/batch, 0, momentum);
     if(l.scales){
-        axpy_cpu(l.n, learning_rate/batch, l.scale_updates, 1, l.scales, 1);
-        scal_cpu(l.n, momentum, l.scale_updates, 1);
+        sgd_update_cpu(l.n, l.scales, l.scale_updates, learning_rate/batch, 0, momentum);
     }
-
-    axpy_cpu(size, -decay*batch, l.weights, 1, l.weight_updates, 1);
-    axpy_cpu(size, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
-    scal_cpu(size, momentum, l.weight_updates, 1);
+    sgd_update_cpu(size, l.weights, l.weight_updates, learning_rate/batch, decay*batch, momentum);
 }
 
 
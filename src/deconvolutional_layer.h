@@ -15,7 +15,7 @@ void push_deconvolutional_layer(layer l);
 void pull_deconvolutional_layer(layer l);
 #endif
 
-layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int adam);
+layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int adam, int init);
 void resize_deconvolutional_layer(layer *l, int h, int w);
 void forward_deconvolutional_layer(const layer l, network net);
 void update_deconvolutional_layer(layer l, update_args a);
@@ -7,35 +7,74 @@
 #include "box.h"
 #include "image.h"
 #include "demo.h"
+#include "queue.h"
 #include <sys/time.h>
 
 #define DEMO 1
 
-#ifdef OPENCV
-
-static char **demo_names;
-static image **demo_alphabet;
-static int demo_classes;
-
-static network *net;
-static image buff [3];
-static image buff_letter[3];
-static int buff_index = 0;
-static void * cap;
-static float fps = 0;
-static float demo_thresh = 0;
-static float demo_hier = .5;
-static int running = 0;
-
-static int demo_frame = 3;
-static int demo_index = 0;
-static float **predictions;
-static float *avg;
-static int demo_done = 0;
-static int demo_total = 0;
-double demo_time;
-
-detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+/* the demo is a five stage pipeline connected by bounded lock-free queues:
+ *
+ *   decode -> preprocess -> infer (x workers) -> postprocess -> sink
+ *
+ * decode reads frames from a camera, a video file or a list of image files,
+ * preprocess letterboxes them, each infer worker owns a network that shares
+ * the first worker's weights and turns a frame into detections, postprocess
+ * runs nms and draws, and the sink shows, saves or prints the result on the
+ * calling thread. a NULL frame marks the end of the stream. */
+
+static char *demo_stage_names[DEMO_STAGES] = {"decode", "preprocess", "infer", "postprocess", "sink"};
+
+typedef struct{
+    int id;
+    image im;
+    image letter;
+    detection *dets;
+    int nboxes;
+    double start;
+    double lat[DEMO_STAGES];
+} demo_frame;
+
+typedef struct{
+    void *cap;
+    char **paths;
+    int npaths;
+    int index;
+} demo_source;
+
+typedef struct{
+    network **nets;
+    int workers;
+    demo_source src;
+    queue *pre_q;
+    queue *infer_q;
+    queue *post_q;
+    queue *sink_q;
+
+    char **names;
+    image **alphabet;
+    int classes;
+    float thresh;
+    float hier;
+    float nms;
+    int avg;
+    int drop;
+    int skip;
+    int headless;
+    char *prefix;
+
+    char *name;
+    int done;
+    int dropped;
+} demo_state;
+
+typedef struct{
+    demo_state *s;
+    network *net;
+    int total;
+    int index;
+    float **predictions;
+    float *avg;
+} demo_worker;
 
 int size_network(network *net)
 {
@@ -50,300 +89,554 @@ int size_network(network *net)
     return count;
 }
 
-void remember_network(network *net)
+/* averages the detection layer outputs over the last w->s->avg frames seen by
+ * this worker. only meaningful when a single worker sees every frame */
+static void avg_predictions(demo_worker *w)
 {
-    int i;
+    int i, j;
     int count = 0;
+    network *net = w->net;
+    int frames = w->s->avg;
     for(i = 0; i < net->n; ++i){
         layer l = net->layers[i];
         if(l.type == YOLO || l.type == REGION || l.type == DETECTION){
-            memcpy(predictions[demo_index] + count, net->layers[i].output, sizeof(float) * l.outputs);
+            memcpy(w->predictions[w->index] + count, l.output, sizeof(float) * l.outputs);
             count += l.outputs;
         }
     }
-}
-
-detection *avg_predictions(network *net, int *nboxes)
-{
-    int i, j;
-    int count = 0;
-    fill_cpu(demo_total, 0, avg, 1);
-    for(j = 0; j < demo_frame; ++j){
-        axpy_cpu(demo_total, 1./demo_frame, predictions[j], 1, avg, 1);
+    fill_cpu(w->total, 0, w->avg, 1);
+    for(j = 0; j < frames; ++j){
+        axpy_cpu(w->total, 1./frames, w->predictions[j], 1, w->avg, 1);
     }
+    count = 0;
     for(i = 0; i < net->n; ++i){
         layer l = net->layers[i];
         if(l.type == YOLO || l.type == REGION || l.type == DETECTION){
-            memcpy(l.output, avg + count, sizeof(float) * l.outputs);
+            memcpy(l.output, w->avg + count, sizeof(float) * l.outputs);
             count += l.outputs;
         }
     }
-    detection *dets = get_network_boxes(net, buff[0].w, buff[0].h, demo_thresh, demo_hier, 0, 1, nboxes);
-    return dets;
+    w->index = (w->index + 1) % frames;
 }
 
-void *detect_in_thread(void *ptr)
+static int is_image_list(const char *filename)
 {
-    running = 1;
-    float nms = .4;
+    const char *ext = strrchr(filename, '.');
+    return ext && (0 == strcmp(ext, ".txt") || 0 == strcmp(ext, ".list"));
+}
 
-    layer l = net->layers[net->n-1];
-    float *X = buff_letter[(buff_index+2)%3].data;
-    network_predict(net, X);
-
-    /*
-       if(l.type == DETECTION){
-       get_detection_boxes(l, 1, 1, demo_thresh, probs, boxes, 0);
-       } else */
-    remember_network(net);
-    detection *dets = 0;
-    int nboxes = 0;
-    dets = avg_predictions(net, &nboxes);
-
-
-    /*
-       int i,j;
-       box zero = {0};
-       int classes = l.classes;
-       for(i = 0; i < demo_detections; ++i){
-       avg[i].objectness = 0;
-       avg[i].bbox = zero;
-       memset(avg[i].prob, 0, classes*sizeof(float));
-       for(j = 0; j < demo_frame; ++j){
-       axpy_cpu(classes, 1./demo_frame, dets[j][i].prob, 1, avg[i].prob, 1);
-       avg[i].objectness += dets[j][i].objectness * 1./demo_frame;
-       avg[i].bbox.x += dets[j][i].bbox.x * 1./demo_frame;
-       avg[i].bbox.y += dets[j][i].bbox.y * 1./demo_frame;
-       avg[i].bbox.w += dets[j][i].bbox.w * 1./demo_frame;
-       avg[i].bbox.h += dets[j][i].bbox.h * 1./demo_frame;
-       }
-    //copy_cpu(classes, dets[0][i].prob, 1, avg[i].prob, 1);
-    //avg[i].objectness = dets[0][i].objectness;
+static image source_next(demo_source *src)
+{
+    if(src->paths){
+        image im = {0};
+        if(src->index < src->npaths) im = load_image_color(src->paths[src->index++], 0, 0);
+        return im;
+    }
+#ifdef OPENCV
+    return get_image_from_stream(src->cap);
+#else
+    image im = {0};
+    return im;
+#endif
+}
+
+static void open_source(demo_source *src, const char *filename, int cam_index, int w, int h, int frames)
+{
+    if(filename && is_image_list(filename)){
+        list *plist = get_paths((char *)filename);
+        src->npaths = plist->size;
+        src->paths = (char **)list_to_array(plist);
+        free_list(plist);
+        return;
+    }
+#ifdef OPENCV
+    if(filename){
+        printf("video file: %s\n", filename);
+        src->cap = open_video_stream(filename, 0, 0, 0, 0);
+    }else{
+        src->cap = open_video_stream(0, cam_index, w, h, frames);
+    }
+    if(!src->cap) error("Couldn't connect to webcam.\n");
+#else
+    error("Demo needs OpenCV for webcam and video input, pass a list of images instead.\n");
+#endif
+}
+
+/* reads past the s->skip frames that follow every frame that is used */
+static int skip_frames(demo_state *s)
+{
+    int i;
+    for(i = 0; i < s->skip; ++i){
+        image im = source_next(&s->src);
+        if(!im.data) return 0;
+        free_image(im);
     }
-     */
+    return 1;
+}
 
-    if (nms > 0) do_nms_obj(dets, nboxes, l.classes, nms);
+/* ids are only given to frames that enter the pipeline, so the sink sees
+ * every id without gaps and can put them back in order */
+static void *decode_thread(void *ptr)
+{
+    demo_state *s = (demo_state *)ptr;
+    int count = 0;
+    int first = 1;
+    while(!__atomic_load_n(&s->done, __ATOMIC_RELAXED)){
+        if(!first && !skip_frames(s)) break;
+        first = 0;
+        double start = what_time_is_it_now();
+        image im = source_next(&s->src);
+        if(!im.data) break;
+        demo_frame *f = calloc(1, sizeof(demo_frame));
+        f->id = count;
+        f->im = im;
+        f->start = start;
+        f->lat[DEMO_DECODE] = what_time_is_it_now() - start;
+        if(!s->drop){
+            queue_push(s->pre_q, f);
+            ++count;
+        } else if(queue_try_push(s->pre_q, f)){
+            ++count;
+        } else {
+            free_image(f->im);
+            free(f);
+            __atomic_add_fetch(&s->dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    queue_push(s->pre_q, 0);
+    return 0;
+}
 
-    printf("\033[2J");
-    printf("\033[1;1H");
-    printf("\nFPS:%.1f\n",fps);
-    printf("Objects:\n\n");
-    image display = buff[(buff_index+2) % 3];
-    draw_detections(display, dets, nboxes, demo_thresh, demo_names, demo_alphabet, demo_classes);
-    free_detections(dets, nboxes);
+static void *preprocess_thread(void *ptr)
+{
+    demo_state *s = (demo_state *)ptr;
+    network *net = s->nets[0];
+    int i;
+    while(1){
+        demo_frame *f = queue_pop(s->pre_q);
+        if(!f) break;
+        double start = what_time_is_it_now();
+        f->letter = letterbox_image(f->im, net->w, net->h);
+        f->lat[DEMO_PREPROCESS] = what_time_is_it_now() - start;
+        queue_push(s->infer_q, f);
+    }
+    for(i = 0; i < s->workers; ++i) queue_push(s->infer_q, 0);
+    return 0;
+}
 
-    demo_index = (demo_index + 1)%demo_frame;
-    running = 0;
+static void *infer_thread(void *ptr)
+{
+    demo_worker *w = (demo_worker *)ptr;
+    demo_state *s = w->s;
+#ifdef GPU
+    cuda_set_device(w->net->gpu_index);
+#endif
+    while(1){
+        demo_frame *f = queue_pop(s->infer_q);
+        if(!f) break;
+        double start = what_time_is_it_now();
+        network_predict(w->net, f->letter.data);
+        if(w->predictions) avg_predictions(w);
+        f->dets = get_network_boxes(w->net, f->im.w, f->im.h, s->thresh, s->hier, 0, 1, &f->nboxes);
+        free_image(f->letter);
+        f->lat[DEMO_INFER] = what_time_is_it_now() - start;
+        queue_push(s->post_q, f);
+    }
+    queue_push(s->post_q, 0);
     return 0;
 }
 
-void *fetch_in_thread(void *ptr)
+static void *postprocess_thread(void *ptr)
 {
-    free_image(buff[buff_index]);
-    buff[buff_index] = get_image_from_stream(cap);
-    if(buff[buff_index].data == 0) {
-        demo_done = 1;
-        return 0;
+    demo_state *s = (demo_state *)ptr;
+    layer l = s->nets[0]->layers[s->nets[0]->n-1];
+    int ended = 0;
+    while(ended < s->workers){
+        demo_frame *f = queue_pop(s->post_q);
+        if(!f){
+            ++ended;
+            continue;
+        }
+        double start = what_time_is_it_now();
+        if (s->nms > 0) do_nms_obj(f->dets, f->nboxes, l.classes, s->nms);
+        cap_detections(f->dets, f->nboxes, l.classes, l.max_detections);
+        if(!s->headless || s->prefix){
+            draw_detections(f->im, f->dets, f->nboxes, s->thresh, s->names, s->alphabet, s->classes);
+        }
+        f->lat[DEMO_POSTPROCESS] = what_time_is_it_now() - start;
+        queue_push(s->sink_q, f);
     }
-    letterbox_image_into(buff[buff_index], net->w, net->h, buff_letter[buff_index]);
+    queue_push(s->sink_q, 0);
     return 0;
 }
 
-void *display_in_thread(void *ptr)
+static void print_frame_detections(demo_state *s, demo_frame *f)
+{
+    int i, j;
+    if(s->name) printf("%s ", s->name);
+    printf("frame %d:", f->id);
+    for(i = 0; i < f->nboxes; ++i){
+        for(j = 0; j < s->classes; ++j){
+            if(f->dets[i].prob[j] > s->thresh){
+                box b = f->dets[i].bbox;
+                printf(" %s %.0f%% [%.3f %.3f %.3f %.3f]", s->names[j], f->dets[i].prob[j]*100, b.x, b.y, b.w, b.h);
+            }
+        }
+    }
+    printf("\n");
+}
+
+#ifdef OPENCV
+static void handle_key(demo_state *s, int c)
 {
-    int c = show_image(buff[(buff_index + 1)%3], "Demo", 1);
     if (c != -1) c = c%256;
     if (c == 27) {
-        demo_done = 1;
-        return 0;
+        __atomic_store_n(&s->done, 1, __ATOMIC_RELAXED);
     } else if (c == 82) {
-        demo_thresh += .02;
+        s->thresh += .02;
     } else if (c == 84) {
-        demo_thresh -= .02;
-        if(demo_thresh <= .02) demo_thresh = .02;
+        s->thresh -= .02;
+        if(s->thresh <= .02) s->thresh = .02;
     } else if (c == 83) {
-        demo_hier += .02;
+        s->hier += .02;
     } else if (c == 81) {
-        demo_hier -= .02;
-        if(demo_hier <= .0) demo_hier = .0;
+        s->hier -= .02;
+        if(s->hier <= .0) s->hier = .0;
     }
-    return 0;
 }
+#endif
 
-void *display_loop(void *ptr)
+static void print_stage_latency(double *sum, double *max, int count, int dropped, double elapsed)
 {
-    while(1){
-        display_in_thread(0);
+    int i;
+    if(!count) return;
+    fprintf(stderr, "frames %d dropped %d fps %.1f |", count, dropped, count/elapsed);
+    for(i = 0; i < DEMO_STAGES; ++i){
+        fprintf(stderr, " %s %.1f/%.1fms", demo_stage_names[i], 1000*sum[i]/count, 1000*max[i]);
     }
+    fprintf(stderr, " | total %.1fms\n", 1000*sum[DEMO_STAGES]/count);
 }
 
-void *detect_loop(void *ptr)
+/* frames finish out of order once there is more than one infer worker, the
+ * sink holds the early ones here until the frames before them are done.
+ * slot i is frame next + i */
+typedef struct{
+    demo_frame **slots;
+    int size;
+    int next;
+} demo_reorder;
+
+static void reorder_put(demo_reorder *r, demo_frame *f)
 {
-    while(1){
-        detect_in_thread(0);
+    int i = f->id - r->next;
+    if(i >= r->size){
+        int size = r->size ? 2*r->size : 16;
+        while(size <= i) size *= 2;
+        r->slots = realloc(r->slots, size*sizeof(demo_frame *));
+        memset(r->slots + r->size, 0, (size - r->size)*sizeof(demo_frame *));
+        r->size = size;
     }
+    r->slots[i] = f;
+}
+
+static demo_frame *reorder_get(demo_reorder *r)
+{
+    if(!r->size || !r->slots[0]) return 0;
+    demo_frame *f = r->slots[0];
+    memmove(r->slots, r->slots + 1, (r->size - 1)*sizeof(demo_frame *));
+    r->slots[r->size - 1] = 0;
+    ++r->next;
+    return f;
 }
 
-void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, int delay, char *prefix, int avg_frames, float hier, int w, int h, int frames, int fullscreen)
+void demo_pipeline(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, char *prefix, int avg_frames, float hier, int w, int h, int frames, int fullscreen, int workers, int depth, int drop, int headless, int skip)
 {
-    //demo_frame = avg_frames;
-    image **alphabet = load_alphabet();
-    demo_names = names;
-    demo_alphabet = alphabet;
-    demo_classes = classes;
-    demo_thresh = thresh;
-    demo_hier = hier;
+    int i, j;
+    demo_state s = {0};
+#ifndef OPENCV
+    headless = 1;
+#endif
+    if(workers < 1) workers = 1;
+    if(depth < 1) depth = 1;
+    if(skip < 0) skip = 0;
+    if(workers > 1 && avg_frames > 1){
+        fprintf(stderr, "Frame averaging needs a single inference worker, disabling it\n");
+        avg_frames = 1;
+    }
+    s.names = names;
+    s.classes = classes;
+    s.thresh = thresh;
+    s.hier = hier;
+    s.nms = .4;
+    s.avg = avg_frames;
+    s.drop = drop;
+    s.skip = skip;
+    s.headless = headless;
+    s.prefix = prefix;
+    s.workers = workers;
+    if(!headless || prefix) s.alphabet = load_alphabet();
     printf("Demo\n");
-    net = load_network(cfgfile, weightfile, 0);
-    set_batch_network(net, 1);
-    pthread_t detect_thread;
-    pthread_t fetch_thread;
 
+    s.nets = calloc(workers, sizeof(network *));
+    s.nets[0] = load_network(cfgfile, weightfile, 0);
+    set_batch_network(s.nets[0], 1);
+    for(i = 1; i < workers; ++i){
+        s.nets[i] = clone_network_shared(s.nets[0], 1);
+    }
     srand(2222222);
 
-    int i;
-    demo_total = size_network(net);
-    predictions = calloc(demo_frame, sizeof(float*));
-    for (i = 0; i < demo_frame; ++i){
-        predictions[i] = calloc(demo_total, sizeof(float));
+    open_source(&s.src, filename, cam_index, w, h, frames);
+
+    s.pre_q = make_queue(depth);
+    s.infer_q = make_queue(depth + workers);
+    s.post_q = make_queue(depth + workers);
+    s.sink_q = make_queue(depth);
+
+    demo_worker *ws = calloc(workers, sizeof(demo_worker));
+    pthread_t *infer_threads = calloc(workers, sizeof(pthread_t));
+    for(i = 0; i < workers; ++i){
+        ws[i].s = &s;
+        ws[i].net = s.nets[i];
+        if(avg_frames > 1){
+            ws[i].total = size_network(s.nets[i]);
+            ws[i].avg = calloc(ws[i].total, sizeof(float));
+            ws[i].predictions = calloc(avg_frames, sizeof(float *));
+            for(j = 0; j < avg_frames; ++j) ws[i].predictions[j] = calloc(ws[i].total, sizeof(float));
+        }
     }
-    avg = calloc(demo_total, sizeof(float));
 
-    if(filename){
-        printf("video file: %s\n", filename);
-        cap = open_video_stream(filename, 0, 0, 0, 0);
-    }else{
-        cap = open_video_stream(0, cam_index, w, h, frames);
+#ifdef OPENCV
+    if(!headless && !prefix){
+        make_window("Demo", 1352, 1013, fullscreen);
     }
+#endif
 
-    if(!cap) error("Couldn't connect to webcam.\n");
-
-    buff[0] = get_image_from_stream(cap);
-    buff[1] = copy_image(buff[0]);
-    buff[2] = copy_image(buff[0]);
-    buff_letter[0] = letterbox_image(buff[0], net->w, net->h);
-    buff_letter[1] = letterbox_image(buff[0], net->w, net->h);
-    buff_letter[2] = letterbox_image(buff[0], net->w, net->h);
-
-    int count = 0;
-    if(!prefix){
-        make_window("Demo", 1352, 1013, fullscreen);
+    pthread_t decode, preprocess, postprocess;
+    if(pthread_create(&decode, 0, decode_thread, &s)) error("Thread creation failed");
+    if(pthread_create(&preprocess, 0, preprocess_thread, &s)) error("Thread creation failed");
+    for(i = 0; i < workers; ++i){
+        if(pthread_create(infer_threads + i, 0, infer_thread, ws + i)) error("Thread creation failed");
     }
+    if(pthread_create(&postprocess, 0, postprocess_thread, &s)) error("Thread creation failed");
 
-    demo_time = what_time_is_it_now();
-
-    while(!demo_done){
-        buff_index = (buff_index + 1) %3;
-        if(pthread_create(&fetch_thread, 0, fetch_in_thread, 0)) error("Thread creation failed");
-        if(pthread_create(&detect_thread, 0, detect_in_thread, 0)) error("Thread creation failed");
-        if(!prefix){
-            fps = 1./(what_time_is_it_now() - demo_time);
-            demo_time = what_time_is_it_now();
-            display_in_thread(0);
-        }else{
+    double sum[DEMO_STAGES + 1] = {0};
+    double max[DEMO_STAGES] = {0};
+    int count = 0;
+    demo_reorder order = {0};
+    double begin = what_time_is_it_now();
+    double report = begin;
+    while(1){
+        demo_frame *f = reorder_get(&order);
+        if(!f){
+            f = queue_pop(s.sink_q);
+            if(!f) break;
+            reorder_put(&order, f);
+            continue;
+        }
+        double start = what_time_is_it_now();
+        if(prefix){
             char name[256];
-            sprintf(name, "%s_%08d", prefix, count);
-            save_image(buff[(buff_index + 1)%3], name);
+            sprintf(name, "%s_%08d", prefix, f->id);
+            save_image(f->im, name);
+        } else if(headless){
+            print_frame_detections(&s, f);
         }
-        pthread_join(fetch_thread, 0);
-        pthread_join(detect_thread, 0);
+#ifdef OPENCV
+        else {
+            handle_key(&s, show_image(f->im, "Demo", 1));
+        }
+#endif
+        double now = what_time_is_it_now();
+        f->lat[DEMO_SINK] = now - start;
+        for(i = 0; i < DEMO_STAGES; ++i){
+            sum[i] += f->lat[i];
+            if(f->lat[i] > max[i]) max[i] = f->lat[i];
+        }
+        sum[DEMO_STAGES] += now - f->start;
         ++count;
+        free_detections(f->dets, f->nboxes);
+        free_image(f->im);
+        free(f);
+        if(now - report > 5){
+            print_stage_latency(sum, max, count, __atomic_load_n(&s.dropped, __ATOMIC_RELAXED), now - begin);
+            report = now;
+        }
+    }
+    print_stage_latency(sum, max, count, __atomic_load_n(&s.dropped, __ATOMIC_RELAXED), what_time_is_it_now() - begin);
+    free(order.slots);
+
+    pthread_join(decode, 0);
+    pthread_join(preprocess, 0);
+    for(i = 0; i < workers; ++i) pthread_join(infer_threads[i], 0);
+    pthread_join(postprocess, 0);
+
+    for(i = workers - 1; i >= 0; --i){
+        if(ws[i].predictions){
+            for(j = 0; j < avg_frames; ++j) free(ws[i].predictions[j]);
+            free(ws[i].predictions);
+            free(ws[i].avg);
+        }
+        free_network(s.nets[i]);
     }
+    free(ws);
+    free(infer_threads);
+    free(s.nets);
+    free_queue(s.pre_q);
+    free_queue(s.infer_q);
+    free_queue(s.post_q);
+    free_queue(s.sink_q);
+    if(s.src.paths) free_ptrs((void **)s.src.paths, s.src.npaths);
 }
 
-/*
-   void demo_compare(char *cfg1, char *weight1, char *cfg2, char *weight2, float thresh, int cam_index, const char *filename, char **names, int classes, int delay, char *prefix, int avg_frames, float hier, int w, int h, int frames, int fullscreen)
-   {
-   demo_frame = avg_frames;
-   predictions = calloc(demo_frame, sizeof(float*));
-   image **alphabet = load_alphabet();
-   demo_names = names;
-   demo_alphabet = alphabet;
-   demo_classes = classes;
-   demo_thresh = thresh;
-   demo_hier = hier;
-   printf("Demo\n");
-   net = load_network(cfg1, weight1, 0);
-   set_batch_network(net, 1);
-   pthread_t detect_thread;
-   pthread_t fetch_thread;
-
-   srand(2222222);
-
-   if(filename){
-   printf("video file: %s\n", filename);
-   cap = cvCaptureFromFile(filename);
-   }else{
-   cap = cvCaptureFromCAM(cam_index);
-
-   if(w){
-   cvSetCaptureProperty(cap, CV_CAP_PROP_FRAME_WIDTH, w);
-   }
-   if(h){
-   cvSetCaptureProperty(cap, CV_CAP_PROP_FRAME_HEIGHT, h);
-   }
-   if(frames){
-   cvSetCaptureProperty(cap, CV_CAP_PROP_FPS, frames);
-   }
-   }
-
-   if(!cap) error("Couldn't connect to webcam.\n");
-
-   layer l = net->layers[net->n-1];
-   demo_detections = l.n*l.w*l.h;
-   int j;
-
-   avg = (float *) calloc(l.outputs, sizeof(float));
-   for(j = 0; j < demo_frame; ++j) predictions[j] = (float *) calloc(l.outputs, sizeof(float));
-
-   boxes = (box *)calloc(l.w*l.h*l.n, sizeof(box));
-   probs = (float **)calloc(l.w*l.h*l.n, sizeof(float *));
-   for(j = 0; j < l.w*l.h*l.n; ++j) probs[j] = (float *)calloc(l.classes+1, sizeof(float));
-
-   buff[0] = get_image_from_stream(cap);
-   buff[1] = copy_image(buff[0]);
-   buff[2] = copy_image(buff[0]);
-   buff_letter[0] = letterbox_image(buff[0], net->w, net->h);
-   buff_letter[1] = letterbox_image(buff[0], net->w, net->h);
-   buff_letter[2] = letterbox_image(buff[0], net->w, net->h);
-   ipl = cvCreateImage(cvSize(buff[0].w,buff[0].h), IPL_DEPTH_8U, buff[0].c);
-
-   int count = 0;
-   if(!prefix){
-   cvNamedWindow("Demo", CV_WINDOW_NORMAL); 
-   if(fullscreen){
-   cvSetWindowProperty("Demo", CV_WND_PROP_FULLSCREEN, CV_WINDOW_FULLSCREEN);
-   } else {
-   cvMoveWindow("Demo", 0, 0);
-   cvResizeWindow("Demo", 1352, 1013);
-   }
-   }
-
-   demo_time = what_time_is_it_now();
-
-   while(!demo_done){
-buff_index = (buff_index + 1) %3;
-if(pthread_create(&fetch_thread, 0, fetch_in_thread, 0)) error("Thread creation failed");
-if(pthread_create(&detect_thread, 0, detect_in_thread, 0)) error("Thread creation failed");
-if(!prefix){
-    fps = 1./(what_time_is_it_now() - demo_time);
-    demo_time = what_time_is_it_now();
-    display_in_thread(0);
-}else{
-    char name[256];
-    sprintf(name, "%s_%08d", prefix, count);
-    save_image(buff[(buff_index + 1)%3], name);
-}
-pthread_join(fetch_thread, 0);
-pthread_join(detect_thread, 0);
-++count;
-}
-}
-*/
-#else
-void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, int delay, char *prefix, int avg, float hier, int w, int h, int frames, int fullscreen)
+/* one network serving many streams. every source gets its own decode thread
+ * and frame queue, and the calling thread gathers up to batch frames round
+ * robin across the streams, one per stream per pass, and runs them through a
+ * single batched forward pass. a camera is given by its index, anything else
+ * is a video file or a list of images */
+typedef struct{
+    demo_state s;
+    int frames;
+    int ended;
+} demo_stream;
+
+static void print_stream_stats(demo_stream *st, int nsources, int passes, int batched, double elapsed)
 {
-    fprintf(stderr, "Demo needs OpenCV for webcam images.\n");
+    int i;
+    if(!passes) return;
+    fprintf(stderr, "passes %d mean batch %.1f |", passes, (float)batched/passes);
+    for(i = 0; i < nsources; ++i){
+        fprintf(stderr, " %s %d/%d %.1ffps", st[i].s.name, st[i].frames, __atomic_load_n(&st[i].s.dropped, __ATOMIC_RELAXED), st[i].frames/elapsed);
+    }
+    fprintf(stderr, "\n");
 }
+
+void demo_streams(char *cfgfile, char *weightfile, float thresh, char **sources, int nsources, char **names, int classes, char *prefix, float hier, int batch, int depth, int drop, int headless)
+{
+    int i, b;
+#ifndef OPENCV
+    headless = 1;
+#endif
+    if(batch < 1) batch = nsources;
+    if(depth < 1) depth = 1;
+    network *net = parse_network_cfg_batch(cfgfile, batch);
+    if(weightfile && weightfile[0] != 0){
+        load_weights(net, weightfile);
+    }
+    layer l = net->layers[net->n-1];
+    image **alphabet = (!headless || prefix) ? load_alphabet() : 0;
+    float nms = .4;
+    srand(2222222);
+
+    demo_stream *st = calloc(nsources, sizeof(demo_stream));
+    pthread_t *decode = calloc(nsources, sizeof(pthread_t));
+    for(i = 0; i < nsources; ++i){
+        demo_state *s = &st[i].s;
+        char *end;
+        long cam_index = strtol(sources[i], &end, 10);
+        open_source(&s->src, *end ? sources[i] : 0, cam_index, 0, 0, 0);
+        s->pre_q = make_queue(depth);
+        s->drop = drop;
+        s->names = names;
+        s->classes = classes;
+        s->thresh = thresh;
+        s->name = sources[i];
+        if(pthread_create(decode + i, 0, decode_thread, s)) error("Thread creation failed");
+    }
+
+    float *X = calloc(batch*net->inputs, sizeof(float));
+    demo_frame **frames = calloc(batch, sizeof(demo_frame *));
+    int *owner = calloc(batch, sizeof(int));
+    int live = nsources;
+    int next = 0;
+    int spins = 0;
+    int passes = 0;
+    int batched = 0;
+    double begin = what_time_is_it_now();
+    double report = begin;
+    while(live){
+        int n = 0;
+        for(i = 0; i < nsources && n < batch; ++i){
+            int k = (next + i) % nsources;
+            void *val;
+            if(st[k].ended || !queue_try_pop(st[k].s.pre_q, &val)) continue;
+            if(!val){
+                st[k].ended = 1;
+                --live;
+                continue;
+            }
+            frames[n] = val;
+            owner[n] = k;
+            ++n;
+        }
+        next = (next + 1) % nsources;
+        if(!n){
+            queue_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        for(b = 0; b < n; ++b){
+            image letter = letterbox_image(frames[b]->im, net->w, net->h);
+            memcpy(X + b*net->inputs, letter.data, net->inputs*sizeof(float));
+            free_image(letter);
+        }
+        if(net->batch != n) set_batch_network(net, n);
+        network_predict(net, X);
+        ++passes;
+        batched += n;
+
+        for(b = 0; b < n; ++b){
+            demo_frame *f = frames[b];
+            demo_stream *stream = st + owner[b];
+            f->dets = get_network_boxes_batch(net, b, f->im.w, f->im.h, thresh, hier, 0, 1, &f->nboxes);
+            if (nms > 0) do_nms_obj(f->dets, f->nboxes, l.classes, nms);
+            cap_detections(f->dets, f->nboxes, l.classes, l.max_detections);
+            if(!headless || prefix){
+                draw_detections(f->im, f->dets, f->nboxes, thresh, names, alphabet, classes);
+            }
+            if(prefix){
+                char name[256];
+                sprintf(name, "%s_%02d_%08d", prefix, owner[b], f->id);
+                save_image(f->im, name);
+            } else if(headless){
+                print_frame_detections(&stream->s, f);
+            }
+#ifdef OPENCV
+            else {
+                int c = show_image(f->im, stream->s.name, 1);
+                if(c != -1 && c%256 == 27){
+                    for(i = 0; i < nsources; ++i) __atomic_store_n(&st[i].s.done, 1, __ATOMIC_RELAXED);
+                }
+            }
 #endif
+            ++stream->frames;
+            free_detections(f->dets, f->nboxes);
+            free_image(f->im);
+            free(f);
+        }
 
+        double now = what_time_is_it_now();
+        if(now - report > 5){
+            print_stream_stats(st, nsources, passes, batched, now - begin);
+            report = now;
+        }
+    }
+    print_stream_stats(st, nsources, passes, batched, what_time_is_it_now() - begin);
+
+    for(i = 0; i < nsources; ++i){
+        pthread_join(decode[i], 0);
+        free_queue(st[i].s.pre_q);
+        if(st[i].s.src.paths) free_ptrs((void **)st[i].s.src.paths, st[i].s.src.npaths);
+    }
+    free(decode);
+    free(st);
+    free(X);
+    free(frames);
+    free(owner);
+    free_network(net);
+}
+
+void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, int frame_skip, char *prefix, int avg_frames, float hier, int w, int h, int frames, int fullscreen)
+{
+    demo_pipeline(cfgfile, weightfile, thresh, cam_index, filename, names, classes, prefix, avg_frames, hier, w, h, frames, fullscreen, 1, 3, filename == 0, 0, frame_skip);
+}
@@ -3,4 +3,8 @@
 
 #include "image.h"
 
+typedef enum{
+    DEMO_DECODE, DEMO_PREPROCESS, DEMO_INFER, DEMO_POSTPROCESS, DEMO_SINK, DEMO_STAGES
+} demo_stage;
+
 #endif
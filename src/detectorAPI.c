@@ -16,6 +16,7 @@ DETECT_RET det_init(const char *cfgFile, const char *weightFile, const char *nam
 	detector->m_names = get_labels(nameFile);
 	detector->m_thresh = 0.1;
 	detector->m_hier_thresh = 0.5;
+	detector->m_max_dets = detector->m_net->layers[detector->m_net->n-1].max_detections;
 	detector->res = NULL;
     detector->resNum = 0;
 	return DETECT_SUCCESS;
@@ -72,6 +73,7 @@ DETECT_RET detect(Detector_t *detector, const image im)//  Result_t **detRes
 	/* if (nms) do_nms_sort(dets, nboxes, l.classes, nms); */
     if (nms)
         diounms_sort(dets, nboxes, l.classes, nms, "iou", "greedynms");
+    cap_detections(dets, nboxes, l.classes, detector->m_max_dets);
 	Res_t *res = calloc(nboxes, sizeof(Res_t));
 	//*detRes = calloc(nboxes, sizeof(Result_t));
 	detector->res = calloc(nboxes, sizeof(Result_t));
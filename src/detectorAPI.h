@@ -6,10 +6,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifndef MAX_DETECT_NUM
-#define MAX_DETECT_NUM 200
-#endif/*MAX_DETECT_NUM*/
-
 #define GPU 1
 network *g_net;
 
@@ -42,6 +38,7 @@ typedef struct Detector
 	int m_last_height;
 	int m_last_num;
 	int m_last_total_size;
+	int m_max_dets;
 	//box *m_boxes;
 	//float** m_probs;
 	int resNum;
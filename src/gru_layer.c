@@ -38,34 +38,34 @@ layer make_gru_layer(int batch, int inputs, int outputs, int steps, int batch_no
 
     l.uz = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.uz) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.uz) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.uz->batch = batch;
 
     l.wz = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.wz) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.wz) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.wz->batch = batch;
 
     l.ur = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.ur) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.ur) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.ur->batch = batch;
 
     l.wr = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.wr) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.wr) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.wr->batch = batch;
 
 
 
     l.uh = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.uh) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.uh) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.uh->batch = batch;
 
     l.wh = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.wh) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.wh) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.wh->batch = batch;
 
     l.batch_normalize = batch_normalize;
@@ -125,6 +125,14 @@ void update_gru_layer(layer l, update_args a)
     update_connected_layer(*(l.wh), a);
 }
 
+/* the input projections of all steps in one gemm, the rows are independent
+ * unless batchnorm is still collecting statistics */
+static void forward_all_steps(layer l, network s, int steps)
+{
+    l.batch *= steps;
+    forward_connected_layer(l, s);
+}
+
 void forward_gru_layer(layer l, network net)
 {
     network s = net;
@@ -150,44 +158,34 @@ void forward_gru_layer(layer l, network net)
         copy_cpu(l.outputs*l.batch, l.state, 1, l.prev_state, 1);
     }
 
+    int hoist = !(l.batch_normalize && net.train);
+    if(hoist){
+        s.input = net.input;
+        forward_all_steps(uz, s, l.steps);
+        forward_all_steps(ur, s, l.steps);
+        forward_all_steps(uh, s, l.steps);
+    }
+
     for (i = 0; i < l.steps; ++i) {
         s.input = l.state;
         forward_connected_layer(wz, s);
         forward_connected_layer(wr, s);
 
-        s.input = net.input;
-        forward_connected_layer(uz, s);
-        forward_connected_layer(ur, s);
-        forward_connected_layer(uh, s);
-
-
-        copy_cpu(l.outputs*l.batch, uz.output, 1, l.z_cpu, 1);
-        axpy_cpu(l.outputs*l.batch, 1, wz.output, 1, l.z_cpu, 1);
-
-        copy_cpu(l.outputs*l.batch, ur.output, 1, l.r_cpu, 1);
-        axpy_cpu(l.outputs*l.batch, 1, wr.output, 1, l.r_cpu, 1);
-
-        activate_array(l.z_cpu, l.outputs*l.batch, LOGISTIC);
-        activate_array(l.r_cpu, l.outputs*l.batch, LOGISTIC);
+        if(!hoist){
+            s.input = net.input;
+            forward_connected_layer(uz, s);
+            forward_connected_layer(ur, s);
+            forward_connected_layer(uh, s);
+        }
 
-        copy_cpu(l.outputs*l.batch, l.state, 1, l.forgot_state, 1);
-        mul_cpu(l.outputs*l.batch, l.r_cpu, 1, l.forgot_state, 1);
+        gru_gates_cpu(l.outputs*l.batch, uz.output, wz.output, ur.output, wr.output,
+                l.state, l.z_cpu, l.r_cpu, l.forgot_state);
 
         s.input = l.forgot_state;
         forward_connected_layer(wh, s);
 
-        copy_cpu(l.outputs*l.batch, uh.output, 1, l.h_cpu, 1);
-        axpy_cpu(l.outputs*l.batch, 1, wh.output, 1, l.h_cpu, 1);
-
-        if(l.tanh){
-            activate_array(l.h_cpu, l.outputs*l.batch, TANH);
-        } else {
-            activate_array(l.h_cpu, l.outputs*l.batch, LOGISTIC);
-        }
-
-        weighted_sum_cpu(l.state, l.h_cpu, l.z_cpu, l.outputs*l.batch, l.output);
-
-        copy_cpu(l.outputs*l.batch, l.output, 1, l.state, 1);
+        gru_output_cpu(l.outputs*l.batch, uh.output, wh.output, l.z_cpu, l.tanh,
+                l.h_cpu, l.state, l.output);
 
         net.input += l.inputs*l.batch;
         l.output += l.outputs*l.batch;
@@ -38,3 +38,30 @@ void im2col_cpu(float* data_im,
     }
 }
 
+
+/* im2col with the matrix transposed, one row of channels*ksize*ksize values
+ * per output location, so the patch of a location is contiguous */
+void im2row_cpu(float* data_im,
+     int channels,  int height,  int width,
+     int ksize,  int stride, int pad, float* data_row)
+{
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    int channels_col = channels * ksize * ksize;
+    int h;
+    #pragma omp parallel for
+    for (h = 0; h < height_col; ++h) {
+        int w, c, i, j;
+        for (w = 0; w < width_col; ++w) {
+            float *row = data_row + (h * width_col + w) * channels_col;
+            for (c = 0; c < channels; ++c) {
+                for (j = 0; j < ksize; ++j) {
+                    for (i = 0; i < ksize; ++i) {
+                        *row++ = im2col_get_pixel(data_im, height, width, channels,
+                                h * stride + j, w * stride + i, c, pad);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -4,6 +4,9 @@
 void im2col_cpu(float* data_im,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_col);
+void im2row_cpu(float* data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad, float* data_row);
 
 #ifdef GPU
 
@@ -23,7 +23,7 @@ int local_out_width(local_layer l)
     return w/l.stride + 1;
 }
 
-local_layer make_local_layer(int batch, int h, int w, int c, int n, int size, int stride, int pad, ACTIVATION activation)
+local_layer make_local_layer(int batch, int h, int w, int c, int n, int size, int stride, int pad, ACTIVATION activation, int init)
 {
     int i;
     local_layer l = {0};
@@ -55,12 +55,12 @@ local_layer make_local_layer(int batch, int h, int w, int c, int n, int size, in
 
     // float scale = 1./sqrt(size*size*c);
     float scale = sqrt(2./(size*size*c));
-    for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_uniform(-1,1);
+    for(i = 0; i < c*n*size*size && init; ++i) l.weights[i] = scale*rand_uniform(-1,1);
 
     l.output = calloc(l.batch*out_h * out_w * n, sizeof(float));
     l.delta  = calloc(l.batch*out_h * out_w * n, sizeof(float));
 
-    l.workspace_size = out_h*out_w*size*size*c;
+    l.workspace_size = (size_t)out_h*out_w*size*size*c*sizeof(float);
     
     l.forward = forward_local_layer;
     l.backward = backward_local_layer;
@@ -94,26 +94,31 @@ void forward_local_layer(const local_layer l, network net)
     int out_w = local_out_width(l);
     int i, j;
     int locations = out_h * out_w;
+    int k = l.size*l.size*l.c;
 
     for(i = 0; i < l.batch; ++i){
         copy_cpu(l.outputs, l.biases, 1, l.output + i*l.outputs, 1);
     }
 
+    /* every location has its own filters, so there is nothing to share
+     * between them: lay the patches out contiguously and take all filters of
+     * all locations as plain dot products in one parallel sweep */
     for(i = 0; i < l.batch; ++i){
         float *input = net.input + i*l.w*l.h*l.c;
-        im2col_cpu(input, l.c, l.h, l.w, 
+        im2row_cpu(input, l.c, l.h, l.w, 
                 l.size, l.stride, l.pad, net.workspace);
         float *output = l.output + i*l.outputs;
+        #pragma omp parallel for
         for(j = 0; j < locations; ++j){
-            float *a = l.weights + j*l.size*l.size*l.c*l.n;
-            float *b = net.workspace + j;
-            float *c = output + j;
-
-            int m = l.n;
-            int n = 1;
-            int k = l.size*l.size*l.c;
-
-            gemm(0,0,m,n,k,1,a,k,b,locations,1,c,locations);
+            float *x = net.workspace + j*k;
+            float *w = l.weights + j*k*l.n;
+            int f, q;
+            for(f = 0; f < l.n; ++f){
+                float sum = 0;
+                #pragma omp simd reduction(+:sum)
+                for(q = 0; q < k; ++q) sum += w[f*k + q]*x[q];
+                output[f*locations + j] += sum;
+            }
         }
     }
     activate_array(l.output, l.outputs*l.batch, l.activation);
@@ -123,6 +128,7 @@ void backward_local_layer(local_layer l, network net)
 {
     int i, j;
     int locations = l.out_w*l.out_h;
+    int k = l.size*l.size*l.c;
 
     gradient_array(l.output, l.outputs*l.batch, l.activation, l.delta);
 
@@ -132,34 +138,30 @@ void backward_local_layer(local_layer l, network net)
 
     for(i = 0; i < l.batch; ++i){
         float *input = net.input + i*l.w*l.h*l.c;
-        im2col_cpu(input, l.c, l.h, l.w, 
+        im2row_cpu(input, l.c, l.h, l.w, 
                 l.size, l.stride, l.pad, net.workspace);
-
-        for(j = 0; j < locations; ++j){ 
-            float *a = l.delta + i*l.outputs + j;
-            float *b = net.workspace + j;
-            float *c = l.weight_updates + j*l.size*l.size*l.c*l.n;
-            int m = l.n;
-            int n = l.size*l.size*l.c;
-            int k = 1;
-
-            gemm(0,1,m,n,k,1,a,locations,b,locations,1,c,n);
+        float *delta = l.delta + i*l.outputs;
+        /* once a location's patch has fed its weight updates, the same row
+         * takes the patch's gradient */
+        #pragma omp parallel for
+        for(j = 0; j < locations; ++j){
+            float *x = net.workspace + j*k;
+            float *w = l.weights + j*k*l.n;
+            float *u = l.weight_updates + j*k*l.n;
+            int f, q;
+            for(f = 0; f < l.n; ++f){
+                float d = delta[f*locations + j];
+                for(q = 0; q < k; ++q) u[f*k + q] += d*x[q];
+            }
+            if(!net.delta) continue;
+            for(q = 0; q < k; ++q) x[q] = 0;
+            for(f = 0; f < l.n; ++f){
+                float d = delta[f*locations + j];
+                for(q = 0; q < k; ++q) x[q] += d*w[f*k + q];
+            }
         }
-
         if(net.delta){
-            for(j = 0; j < locations; ++j){ 
-                float *a = l.weights + j*l.size*l.size*l.c*l.n;
-                float *b = l.delta + i*l.outputs + j;
-                float *c = net.workspace + j;
-
-                int m = l.size*l.size*l.c;
-                int n = 1;
-                int k = l.n;
-
-                gemm(1,0,m,n,k,1,a,m,b,locations,0,c,locations);
-            }
-
-            col2im_cpu(net.workspace, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, net.delta+i*l.c*l.h*l.w);
+            row2im_cpu(net.workspace, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, net.delta+i*l.c*l.h*l.w);
         }
     }
 }
@@ -173,12 +175,8 @@ void update_local_layer(local_layer l, update_args a)
 
     int locations = l.out_w*l.out_h;
     int size = l.size*l.size*l.c*l.n*locations;
-    axpy_cpu(l.outputs, learning_rate/batch, l.bias_updates, 1, l.biases, 1);
-    scal_cpu(l.outputs, momentum, l.bias_updates, 1);
-
-    axpy_cpu(size, -decay*batch, l.weights, 1, l.weight_updates, 1);
-    axpy_cpu(size, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
-    scal_cpu(size, momentum, l.weight_updates, 1);
+    sgd_update_cpu(l.outputs, l.biases, l.bias_updates, learning_rate/batch, 0, momentum);
+    sgd_update_cpu(size, l.weights, l.weight_updates, learning_rate/batch, decay*batch, momentum);
 }
 
 #ifdef GPU
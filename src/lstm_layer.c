@@ -38,42 +38,42 @@ layer make_lstm_layer(int batch, int inputs, int outputs, int steps, int batch_n
 
     l.uf = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.uf) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.uf) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.uf->batch = batch;
 
     l.ui = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.ui) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.ui) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.ui->batch = batch;
 
     l.ug = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.ug) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.ug) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.ug->batch = batch;
 
     l.uo = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.uo) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.uo) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.uo->batch = batch;
 
     l.wf = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.wf) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.wf) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.wf->batch = batch;
 
     l.wi = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.wi) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.wi) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.wi->batch = batch;
 
     l.wg = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.wg) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.wg) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.wg->batch = batch;
 
     l.wo = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.wo) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam);
+    *(l.wo) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, adam, 1);
     l.wo->batch = batch;
 
     l.batch_normalize = batch_normalize;
@@ -153,6 +153,14 @@ void update_lstm_layer(layer l, update_args a)
     update_connected_layer(*(l.uo), a);
 }
 
+/* the input projections of all steps in one gemm, the rows are independent
+ * unless batchnorm is still collecting statistics */
+static void forward_all_steps(layer l, network s, int steps)
+{
+    l.batch *= steps;
+    forward_connected_layer(l, s);
+}
+
 void forward_lstm_layer(layer l, network state)
 {
     network s = { 0 };
@@ -168,59 +176,48 @@ void forward_lstm_layer(layer l, network state)
     layer ug = *(l.ug);
     layer uo = *(l.uo);
 
-    fill_cpu(l.outputs * l.batch * l.steps, 0, wf.delta, 1);
-    fill_cpu(l.outputs * l.batch * l.steps, 0, wi.delta, 1);
-    fill_cpu(l.outputs * l.batch * l.steps, 0, wg.delta, 1);
-    fill_cpu(l.outputs * l.batch * l.steps, 0, wo.delta, 1);
-
-    fill_cpu(l.outputs * l.batch * l.steps, 0, uf.delta, 1);
-    fill_cpu(l.outputs * l.batch * l.steps, 0, ui.delta, 1);
-    fill_cpu(l.outputs * l.batch * l.steps, 0, ug.delta, 1);
-    fill_cpu(l.outputs * l.batch * l.steps, 0, uo.delta, 1);
     if (state.train) {
+        fill_cpu(l.outputs * l.batch * l.steps, 0, wf.delta, 1);
+        fill_cpu(l.outputs * l.batch * l.steps, 0, wi.delta, 1);
+        fill_cpu(l.outputs * l.batch * l.steps, 0, wg.delta, 1);
+        fill_cpu(l.outputs * l.batch * l.steps, 0, wo.delta, 1);
+
+        fill_cpu(l.outputs * l.batch * l.steps, 0, uf.delta, 1);
+        fill_cpu(l.outputs * l.batch * l.steps, 0, ui.delta, 1);
+        fill_cpu(l.outputs * l.batch * l.steps, 0, ug.delta, 1);
+        fill_cpu(l.outputs * l.batch * l.steps, 0, uo.delta, 1);
         fill_cpu(l.outputs * l.batch * l.steps, 0, l.delta, 1);
     }
 
-    for (i = 0; i < l.steps; ++i) {
-        s.input = l.h_cpu;
-        forward_connected_layer(wf, s);							
-        forward_connected_layer(wi, s);							
-        forward_connected_layer(wg, s);							
-        forward_connected_layer(wo, s);							
-
+    int hoist = !(l.batch_normalize && state.train);
+    if (hoist) {
         s.input = state.input;
-        forward_connected_layer(uf, s);							
-        forward_connected_layer(ui, s);							
-        forward_connected_layer(ug, s);							
-        forward_connected_layer(uo, s);							
-
-        copy_cpu(l.outputs*l.batch, wf.output, 1, l.f_cpu, 1);
-        axpy_cpu(l.outputs*l.batch, 1, uf.output, 1, l.f_cpu, 1);
-
-        copy_cpu(l.outputs*l.batch, wi.output, 1, l.i_cpu, 1);	
-        axpy_cpu(l.outputs*l.batch, 1, ui.output, 1, l.i_cpu, 1);	
-
-        copy_cpu(l.outputs*l.batch, wg.output, 1, l.g_cpu, 1);	
-        axpy_cpu(l.outputs*l.batch, 1, ug.output, 1, l.g_cpu, 1);	
-
-        copy_cpu(l.outputs*l.batch, wo.output, 1, l.o_cpu, 1);	
-        axpy_cpu(l.outputs*l.batch, 1, uo.output, 1, l.o_cpu, 1);	
-
-        activate_array(l.f_cpu, l.outputs*l.batch, LOGISTIC);		
-        activate_array(l.i_cpu, l.outputs*l.batch, LOGISTIC);		
-        activate_array(l.g_cpu, l.outputs*l.batch, TANH);			
-        activate_array(l.o_cpu, l.outputs*l.batch, LOGISTIC);		
-
-        copy_cpu(l.outputs*l.batch, l.i_cpu, 1, l.temp_cpu, 1);		
-        mul_cpu(l.outputs*l.batch, l.g_cpu, 1, l.temp_cpu, 1);		
-        mul_cpu(l.outputs*l.batch, l.f_cpu, 1, l.c_cpu, 1);			
-        axpy_cpu(l.outputs*l.batch, 1, l.temp_cpu, 1, l.c_cpu, 1);	
-
-        copy_cpu(l.outputs*l.batch, l.c_cpu, 1, l.h_cpu, 1);			
-        activate_array(l.h_cpu, l.outputs*l.batch, TANH);		
-        mul_cpu(l.outputs*l.batch, l.o_cpu, 1, l.h_cpu, 1);	
+        forward_all_steps(uf, s, l.steps);
+        forward_all_steps(ui, s, l.steps);
+        forward_all_steps(ug, s, l.steps);
+        forward_all_steps(uo, s, l.steps);
+    }
 
-        copy_cpu(l.outputs*l.batch, l.c_cpu, 1, l.cell_cpu, 1);		
+    for (i = 0; i < l.steps; ++i) {
+        s.input = l.h_cpu;
+        forward_connected_layer(wf, s);
+        forward_connected_layer(wi, s);
+        forward_connected_layer(wg, s);
+        forward_connected_layer(wo, s);
+
+        if (!hoist) {
+            s.input = state.input;
+            forward_connected_layer(uf, s);
+            forward_connected_layer(ui, s);
+            forward_connected_layer(ug, s);
+            forward_connected_layer(uo, s);
+        }
+
+        lstm_gates_cpu(l.outputs*l.batch, wf.output, uf.output, wi.output, ui.output,
+                wg.output, ug.output, wo.output, uo.output,
+                l.f_cpu, l.i_cpu, l.g_cpu, l.o_cpu, l.c_cpu, l.h_cpu);
+
+        copy_cpu(l.outputs*l.batch, l.c_cpu, 1, l.cell_cpu, 1);
         copy_cpu(l.outputs*l.batch, l.h_cpu, 1, l.output, 1);
 
         state.input += l.inputs*l.batch;
@@ -1,6 +1,7 @@
 #include "maxpool_layer.h"
 #include "cuda.h"
 #include <stdio.h>
+#include <float.h>
 
 image get_maxpool_image(maxpool_layer l)
 {
@@ -18,6 +19,14 @@ image get_maxpool_delta(maxpool_layer l)
     return float_to_image(w,h,c,l.delta);
 }
 
+/* one plane pooled along x, then the running max buffers */
+size_t get_maxpool_workspace_size(maxpool_layer l)
+{
+    size_t row = l.out_w + l.size - 1;
+    size_t col = (size_t)(l.out_h + l.size - 1)*l.out_w;
+    return ((size_t)l.h*l.out_w + 2*(row > col ? row : col))*sizeof(float);
+}
+
 maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding)
 {
     maxpool_layer l = {0};
@@ -34,6 +43,7 @@ maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int s
     l.inputs = h*w*c;
     l.size = size;
     l.stride = stride;
+    l.workspace_size = get_maxpool_workspace_size(l);
     int output_size = l.out_h * l.out_w * l.out_c * batch;
     l.indexes = calloc(output_size, sizeof(int));
     l.output =  calloc(output_size, sizeof(float));
@@ -60,6 +70,7 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     l->out_w = (w + l->pad - l->size)/l->stride + 1;
     l->out_h = (h + l->pad - l->size)/l->stride + 1;
     l->outputs = l->out_w * l->out_h * l->c;
+    l->workspace_size = get_maxpool_workspace_size(*l);
     int output_size = l->outputs * l->batch;
 
     l->indexes = realloc(l->indexes, output_size * sizeof(int));
@@ -76,8 +87,125 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     #endif
 }
 
+/* max over windows of size blocks of len floats, block j of out covers
+ * blocks j*stride + offset ... of x, blocks outside x count as -FLT_MAX.
+ * inlined with constant size and stride for the common 2/2 and 3/1 */
+static inline void pool_max(const float *x, int n, int len, int size, int stride, int offset, int n_out, float *out)
+{
+    int i, j, p;
+    for(j = 0; j < n_out; ++j){
+        int start = j*stride + offset;
+        int lo = start < 0 ? 0 : start;
+        int hi = start + size > n ? n : start + size;
+        float *o = out + j*len;
+        for(i = 0; i < len; ++i) o[i] = -FLT_MAX;
+        for(p = lo; p < hi; ++p){
+            const float *v = x + p*len;
+            for(i = 0; i < len; ++i) o[i] = (v[i] > o[i]) ? v[i] : o[i];
+        }
+    }
+}
+
+/* pool_max for a single row, the windows that lie inside it skip the
+ * clipping so the loop over them vectorizes */
+static inline void pool_row(const float *x, int n, int size, int stride, int offset, int n_out, float *out)
+{
+    int j, p;
+    int j0 = offset < 0 ? (-offset + stride - 1)/stride : 0;
+    int j1 = n - size - offset >= 0 ? (n - size - offset)/stride + 1 : 0;
+    if(j0 > n_out) j0 = n_out;
+    if(j1 > n_out) j1 = n_out;
+    if(j1 < j0) j1 = j0;
+    pool_max(x, n, 1, size, stride, offset, j0, out);
+    for(j = j0; j < j1; ++j){
+        const float *v = x + j*stride + offset;
+        float m = v[0];
+        for(p = 1; p < size; ++p) m = (v[p] > m) ? v[p] : m;
+        out[j] = m;
+    }
+    for(j = j1; j < n_out; ++j){
+        pool_max(x, n, 1, size, stride, offset + j*stride, 1, out + j);
+    }
+}
+
+/* the same with stride 1 in three compares per float whatever the size, van
+ * herk / gil-werman: split the padded line in blocks of size, keep the max
+ * from the block start (g) and up to the block end (h), every window then
+ * is max(h at its start, g at its end). g and h take n_out + size - 1 blocks */
+static void running_max(const float *x, int n, int len, int size, int offset, int n_out, float *g, float *h, float *out)
+{
+    int i, p;
+    int t = n_out + size - 1;
+    for(p = 0; p < t; ++p){
+        int q = p + offset;
+        const float *v = x + (q < 0 ? 0 : q)*len;
+        float *gp = g + p*len;
+        if(q < 0 || q >= n){
+            if(p%size == 0) for(i = 0; i < len; ++i) gp[i] = -FLT_MAX;
+            else memcpy(gp, gp - len, len*sizeof(float));
+        } else if(p%size == 0){
+            memcpy(gp, v, len*sizeof(float));
+        } else {
+            for(i = 0; i < len; ++i) gp[i] = (v[i] > gp[i-len]) ? v[i] : gp[i-len];
+        }
+    }
+    for(p = t-1; p >= 0; --p){
+        int q = p + offset;
+        const float *v = x + (q < 0 ? 0 : q)*len;
+        float *hp = h + p*len;
+        if(q < 0 || q >= n){
+            if(p%size == size-1 || p == t-1) for(i = 0; i < len; ++i) hp[i] = -FLT_MAX;
+            else memcpy(hp, hp + len, len*sizeof(float));
+        } else if(p%size == size-1 || p == t-1){
+            memcpy(hp, v, len*sizeof(float));
+        } else {
+            for(i = 0; i < len; ++i) hp[i] = (v[i] > hp[i+len]) ? v[i] : hp[i+len];
+        }
+    }
+    for(p = 0; p < n_out; ++p){
+        const float *a = h + p*len;
+        const float *b = g + (p + size - 1)*len;
+        float *o = out + p*len;
+        for(i = 0; i < len; ++i) o[i] = (a[i] > b[i]) ? a[i] : b[i];
+    }
+}
+
+/* inference only needs the maxima, and max is separable: pool each row along
+ * x into the workspace, then pool those rows along y a whole row at a time */
+static void forward_maxpool_plane(const maxpool_layer l, const float *in, float *out, float *work)
+{
+    int y;
+    int offset = -l.pad/2;
+    float *rows = work;
+    float *g = work + l.h*l.out_w;
+    int row = l.out_w + l.size - 1;
+    int col = (l.out_h + l.size - 1)*l.out_w;
+    float *h = g + (row > col ? row : col);
+    if(l.size == 2 && l.stride == 2){
+        for(y = 0; y < l.h; ++y) pool_row(in + y*l.w, l.w, 2, 2, offset, l.out_w, rows + y*l.out_w);
+        pool_max(rows, l.h, l.out_w, 2, 2, offset, l.out_h, out);
+    } else if(l.size == 3 && l.stride == 1){
+        for(y = 0; y < l.h; ++y) pool_row(in + y*l.w, l.w, 3, 1, offset, l.out_w, rows + y*l.out_w);
+        pool_max(rows, l.h, l.out_w, 3, 1, offset, l.out_h, out);
+    } else if(l.stride == 1 && l.size > 3){
+        for(y = 0; y < l.h; ++y) running_max(in + y*l.w, l.w, 1, l.size, offset, l.out_w, g, h, rows + y*l.out_w);
+        running_max(rows, l.h, l.out_w, l.size, offset, l.out_h, g, h, out);
+    } else {
+        for(y = 0; y < l.h; ++y) pool_row(in + y*l.w, l.w, l.size, l.stride, offset, l.out_w, rows + y*l.out_w);
+        pool_max(rows, l.h, l.out_w, l.size, l.stride, offset, l.out_h, out);
+    }
+}
+
 void forward_maxpool_layer(const maxpool_layer l, network net)
 {
+    if(!net.train && net.workspace){
+        int k;
+        for(k = 0; k < l.batch*l.c; ++k){
+            forward_maxpool_plane(l, net.input + k*l.h*l.w, l.output + k*l.out_h*l.out_w, net.workspace);
+        }
+        return;
+    }
+
     int b,i,j,k,m,n;
     int w_offset = -l.pad/2;
     int h_offset = -l.pad/2;
@@ -9,6 +9,7 @@
 typedef layer maxpool_layer;
 
 image get_maxpool_image(maxpool_layer l);
+size_t get_maxpool_workspace_size(maxpool_layer l);
 maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding);
 void resize_maxpool_layer(maxpool_layer *l, int w, int h);
 void forward_maxpool_layer(const maxpool_layer l, network net);
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "network.h"
 #include "image.h"
 #include "data.h"
@@ -30,6 +34,7 @@
 #include "upsample_layer.h"
 #include "shortcut_layer.h"
 #include "parser.h"
+#include "ring.h"
 #include "data.h"
 
 load_args get_base_args(network *net)
@@ -52,9 +57,15 @@ load_args get_base_args(network *net)
 
 network *load_network(char *cfg, char *weights, int clear)
 {
-    network *net = parse_network_cfg(cfg);
-    if(weights && weights[0] != 0){
-        load_weights(net, weights);
+    network *net;
+    if(is_plan(cfg)){
+        if(weights && weights[0] != 0) fprintf(stderr, "Warning: %s is a compiled plan with its own weights, ignoring %s\n", cfg, weights);
+        net = load_plan(cfg);
+    } else {
+        net = parse_network_cfg(cfg);
+        if(weights && weights[0] != 0){
+            load_weights(net, weights);
+        }
     }
     if(clear) (*net->seen) = 0;
     return net;
@@ -66,10 +77,129 @@ size_t get_current_batch(network *net)
     return batch_num;
 }
 
+/* the tensors a recurrent layer carries between steps when it is not
+ * training, row b of x[k] is sizes[k] floats at x[k] + b*sizes[k] and gx
+ * gets the gpu copies */
+static int recurrent_state(layer *l, float **x, float **gx, int *sizes)
+{
+    switch(l->type){
+        case RNN:
+        case GRU:
+            x[0] = l->state;
+            sizes[0] = l->outputs;
+#ifdef GPU
+            gx[0] = l->state_gpu;
+#endif
+            return 1;
+        case CRNN:
+            x[0] = l->state;
+            sizes[0] = l->hidden;
+#ifdef GPU
+            gx[0] = l->state_gpu;
+#endif
+            return 1;
+        case LSTM:
+            x[0] = l->h_cpu;
+            x[1] = l->c_cpu;
+            sizes[0] = sizes[1] = l->outputs;
+#ifdef GPU
+            gx[0] = l->h_gpu;
+            gx[1] = l->c_gpu;
+#endif
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+static int rnn_state_size(network *net)
+{
+    int i, k, n = 0;
+    float *x[2], *gx[2];
+    int sizes[2];
+    for(i = 0; i < net->n; ++i){
+        int m = recurrent_state(net->layers + i, x, gx, sizes);
+        for(k = 0; k < m; ++k) n += sizes[k];
+    }
+    return n;
+}
+
+rnn_state *make_rnn_state(network *net)
+{
+    rnn_state *s = calloc(1, sizeof(rnn_state));
+    s->n = rnn_state_size(net);
+    s->x = calloc(s->n, sizeof(float));
+    return s;
+}
+
+void free_rnn_state(rnn_state *s)
+{
+    free(s->x);
+    free(s);
+}
+
+/* copies between batch row b of the network and one sequence, direction 1
+ * saves into s and 0 loads from it */
+static void move_rnn_state(network *net, int b, rnn_state *s, int save)
+{
+    int i, k, off = 0;
+    float *x[2], *gx[2];
+    int sizes[2];
+    for(i = 0; i < net->n; ++i){
+        int m = recurrent_state(net->layers + i, x, gx, sizes);
+        for(k = 0; k < m; ++k){
+            float *row = x[k] + b*sizes[k];
+#ifdef GPU
+            if(net->gpu_index >= 0 && save) cuda_pull_array(gx[k] + b*sizes[k], row, sizes[k]);
+#endif
+            if(save) memcpy(s->x + off, row, sizes[k]*sizeof(float));
+            else memcpy(row, s->x + off, sizes[k]*sizeof(float));
+#ifdef GPU
+            if(net->gpu_index >= 0 && !save) cuda_push_array(gx[k] + b*sizes[k], row, sizes[k]);
+#endif
+            off += sizes[k];
+        }
+    }
+}
+
+void save_rnn_state(network *net, int b, rnn_state *s)
+{
+    move_rnn_state(net, b, s, 1);
+}
+
+void load_rnn_state(network *net, int b, rnn_state *s)
+{
+    move_rnn_state(net, b, s, 0);
+}
+
+/* one step of n independent sequences, batch row b runs s[b] on row b of
+ * input. the network needs time_steps=1 and a batch of at least n, the
+ * output of sequence b is at net->outputs*b in what comes back */
+float *rnn_step_batch(network *net, rnn_state **s, int n, float *input)
+{
+    int b;
+    if(net->time_steps != 1) error("rnn_step needs a network with time_steps=1");
+    if(n > net->batch) error("rnn_step_batch: more sequences than the network batch");
+    for(b = 0; b < n; ++b) load_rnn_state(net, b, s[b]);
+    copy_cpu(net->inputs*n, input, 1, net->input, 1);
+    float *out = network_predict(net, net->input);
+    for(b = 0; b < n; ++b) save_rnn_state(net, b, s[b]);
+    return out;
+}
+
+float *rnn_step(network *net, rnn_state *s, float *input)
+{
+    return rnn_step_batch(net, &s, 1, input);
+}
+
 void reset_network_state(network *net, int b)
 {
-    int i;
+    int i, k;
+    float *x[2], *gx[2];
+    int sizes[2];
     for (i = 0; i < net->n; ++i) {
+        int m = recurrent_state(net->layers + i, x, gx, sizes);
+        for(k = 0; k < m; ++k) fill_cpu(sizes[k], 0, x[k] + b*sizes[k], 1);
         #ifdef GPU
         layer l = net->layers[i];
         if(l.state_gpu){
@@ -213,18 +343,171 @@ void forward_network(network *netp)
     calc_network_cost(netp);
 }
 
-void update_network(network *netp)
+static void clear_network_updates(network *net)
 {
-#ifdef GPU
-    if(netp->gpu_index >= 0){
-        update_network_gpu(netp);   
-        return;
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[3];
+    int counts[3];
+    int i, u, k;
+    for(i = 0; i < net->n; ++i){
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_updates(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k) fill_cpu(counts[k], 0, *ptrs[k], 1);
+        }
     }
-#endif
+}
+
+/* hands the finished gradients of layer i to the ring */
+static void push_layer_updates(network *net, int i)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[3];
+    int counts[3];
+    int u, k;
+    int nu = weight_units(net->layers + i, units);
+    for(u = 0; u < nu; ++u){
+        int nt = unit_updates(units[u], ptrs, counts);
+        for(k = 0; k < nt; ++k) ring_push(net->ring, *ptrs[k], counts[k]);
+    }
+}
+
+#define ARENA_ALIGN 16
+
+static size_t arena_align(size_t n)
+{
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/* the arenas hold the units of the layers that update */
+static int arena_units(layer *l, layer **units)
+{
+    if(!l->update || l->type == BATCHNORM) return 0;
+    return weight_units(l, units);
+}
+
+static float *arena_alloc(size_t n)
+{
+    void *p = 0;
+    if(!n) return 0;
+    if(posix_memalign(&p, 64, n*sizeof(float))) error("Arena allocation failed");
+    memset(p, 0, n*sizeof(float));
+    return p;
+}
+
+static int in_arena(float *p, float *arena, size_t size)
+{
+    return arena && p >= arena && p < arena + size;
+}
+
+/* moves the parameters of every layer that updates into one aligned block
+ * and their gradients into another. both are laid out alike, all the weights
+ * first and then all the biases and scales, so a parameter and its gradient
+ * sit at the same offset and the rolling statistics follow in the parameter
+ * arena alone. the layers keep their pointers, now views into the arenas */
+void pack_network_arena(network *net)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    float **grads[3];
+    int counts[MAX_UNIT_TENSORS];
+    int gcounts[3];
+    int i, u, k;
+    size_t nw = 0, nb = 0, no = 0;
+    if(net->param_arena) return;
+    for(i = 0; i < net->n; ++i){
+        int nu = arena_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            int ng = unit_updates(units[u], grads, gcounts);
+            for(k = 0; k < nt; ++k){
+                size_t n = arena_align(counts[k]);
+                if(ptrs[k] == &units[u]->weights) nw += n;
+                else if(k < ng) nb += n;
+                else no += n;
+            }
+        }
+    }
+    net->param_arena_size = nw + nb + no;
+    net->grad_arena_size = nw + nb;
+    net->arena_weights = nw;
+    net->param_arena = arena_alloc(net->param_arena_size);
+    net->grad_arena = arena_alloc(net->grad_arena_size);
+
+    size_t w = 0, b = nw, o = nw + nb;
+    for(i = 0; i < net->n; ++i){
+        int nu = arena_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            int ng = unit_updates(units[u], grads, gcounts);
+            for(k = 0; k < nt; ++k){
+                size_t *off = (ptrs[k] == &units[u]->weights) ? &w : (k < ng) ? &b : &o;
+                float *p = net->param_arena + *off;
+                memcpy(p, *ptrs[k], counts[k]*sizeof(float));
+                free(*ptrs[k]);
+                *ptrs[k] = p;
+                if(k < ng){
+                    float *g = net->grad_arena + *off;
+                    memcpy(g, *grads[k], gcounts[k]*sizeof(float));
+                    free(*grads[k]);
+                    *grads[k] = g;
+                }
+                *off += arena_align(counts[k]);
+            }
+        }
+    }
+}
+
+/* points the views at nothing so free_layer leaves the arenas alone */
+static void free_network_arena(network *net)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    int i, u, k;
+    for(i = 0; i < net->n; ++i){
+        int nu = arena_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k){
+                if(in_arena(*ptrs[k], net->param_arena, net->param_arena_size)) *ptrs[k] = 0;
+            }
+            nt = unit_updates(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k){
+                if(in_arena(*ptrs[k], net->grad_arena, net->grad_arena_size)) *ptrs[k] = 0;
+            }
+        }
+    }
+    free(net->param_arena);
+    free(net->grad_arena);
+    net->param_arena = net->grad_arena = 0;
+}
+
+/* whether one sgd sweep over the arenas is the update every layer would
+ * do: no adam, no per layer learning rates and no views moved elsewhere */
+static int arena_update(network *net)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    int i, u;
+    if(!net->grad_arena || net->adam) return 0;
+    for(i = 0; i < net->n; ++i){
+        int nu = arena_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            layer *l = units[u];
+            if(l->learning_rate_scale != 1) return 0;
+            if(!in_arena(l->weights, net->param_arena, net->arena_weights)) return 0;
+            if(!in_arena(l->biases, net->param_arena, net->grad_arena_size)) return 0;
+        }
+    }
+    return 1;
+}
+
+static void update_network_batch(network *netp, int batch)
+{
     network net = *netp;
     int i;
     update_args a = {0};
-    a.batch = net.batch*net.subdivisions;
+    a.batch = batch;
     a.learning_rate = get_current_rate(netp);
     a.momentum = net.momentum;
     a.decay = net.decay;
@@ -235,6 +518,13 @@ void update_network(network *netp)
     ++*net.t;
     a.t = *net.t;
 
+    if(arena_update(netp)){
+        size_t nw = net.arena_weights;
+        sgd_update_cpu(nw, net.param_arena, net.grad_arena, a.learning_rate/batch, a.decay*batch, a.momentum);
+        sgd_update_cpu(net.grad_arena_size - nw, net.param_arena + nw, net.grad_arena + nw, a.learning_rate/batch, 0, a.momentum);
+        return;
+    }
+
     for(i = 0; i < net.n; ++i){
         layer l = net.layers[i];
         if(l.update){
@@ -243,6 +533,22 @@ void update_network(network *netp)
     }
 }
 
+void update_network(network *netp)
+{
+#ifdef GPU
+    if(netp->gpu_index >= 0){
+        update_network_gpu(netp);   
+        return;
+    }
+#endif
+    int batch = netp->batch*netp->subdivisions;
+    if(netp->ring) batch *= netp->ring->size;
+    update_network_batch(netp, batch);
+    /* after the all-reduce every rank holds the whole momentum, only rank 0
+     * carries it into the next sum */
+    if(netp->ring && netp->ring->rank) clear_network_updates(netp);
+}
+
 void calc_network_cost(network *netp)
 {
     network net = *netp;
@@ -291,6 +597,7 @@ void backward_network(network *netp)
         }
         net.index = i;
         l.backward(l, net);
+        if(netp->ring && netp->ring->armed) push_layer_updates(netp, i);
     }
 }
 
@@ -298,10 +605,15 @@ float train_network_datum(network *net)
 {
     *net->seen += net->batch;
     net->train = 1;
+    int update = ((*net->seen)/net->batch)%net->subdivisions == 0;
+    if(net->ring) net->ring->armed = update;
     forward_network(net);
     backward_network(net);
     float error = *net->cost;
-    if(((*net->seen)/net->batch)%net->subdivisions == 0) update_network(net);
+    if(update){
+        if(net->ring) ring_flush(net->ring);
+        update_network(net);
+    }
     return error;
 }
 
@@ -335,6 +647,189 @@ float train_network(network *net, data d)
     return (float)sum/(n*batch);
 }
 
+/* data parallel training on the cpu. nets[1..n-1] are clones of nets[0]
+ * that share its parameters, each replica runs forward and backward over
+ * its own slice of every update's worth of images on its own share of the
+ * cores, the gradients are summed into nets[0] and only nets[0] updates */
+
+#define REDUCE_BLOCK 4096
+
+typedef struct {
+    network *net;
+    data d;
+    int offset;
+    int threads;
+    float err;
+} replica_args;
+
+static void *replica_thread(void *ptr)
+{
+    replica_args *a = (replica_args *)ptr;
+    network *net = a->net;
+    int batch = net->batch;
+    int i;
+    float sum = 0;
+#ifdef _OPENMP
+    omp_set_num_threads(a->threads);
+#endif
+    net->train = 1;
+    for(i = 0; i < net->subdivisions; ++i){
+        get_next_batch(a->d, batch, a->offset + i*batch, net->input, net->truth);
+        *net->seen += batch;
+        forward_network(net);
+        backward_network(net);
+        sum += *net->cost;
+    }
+    a->err = sum;
+    return 0;
+}
+
+/* sums the gradients of the replicas into nets[0] and clears theirs. the
+ * buffers are cut into blocks and each block is folded across all the
+ * replicas while it sits in cache, the blocks are spread over the threads */
+static void reduce_replicas(network **nets, int n)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[3];
+    int counts[3];
+    int i, j, u, k, b;
+    int nbuf = 0;
+    for(j = 0; j < nets[0]->n; ++j){
+        int nu = weight_units(nets[0]->layers + j, units);
+        for(u = 0; u < nu; ++u) nbuf += unit_updates(units[u], ptrs, counts);
+    }
+    float ***bufs = calloc(nbuf, sizeof(float **));
+    int *sizes = calloc(nbuf, sizeof(int));
+    int *first = calloc(nbuf + 1, sizeof(int));
+    for(i = 0; i < n; ++i){
+        int m = 0;
+        for(j = 0; j < nets[i]->n; ++j){
+            int nu = weight_units(nets[i]->layers + j, units);
+            for(u = 0; u < nu; ++u){
+                int nt = unit_updates(units[u], ptrs, counts);
+                for(k = 0; k < nt; ++k, ++m){
+                    if(!i) bufs[m] = calloc(n, sizeof(float *));
+                    bufs[m][i] = *ptrs[k];
+                    sizes[m] = counts[k];
+                }
+            }
+        }
+    }
+    for(k = 0; k < nbuf; ++k) first[k+1] = first[k] + (sizes[k] + REDUCE_BLOCK - 1)/REDUCE_BLOCK;
+    int nblocks = first[nbuf];
+
+    #pragma omp parallel for private(k, i)
+    for(b = 0; b < nblocks; ++b){
+        k = 0;
+        while(first[k+1] <= b) ++k;
+        int start = (b - first[k])*REDUCE_BLOCK;
+        int len = sizes[k] - start < REDUCE_BLOCK ? sizes[k] - start : REDUCE_BLOCK;
+        float *dst = bufs[k][0] + start;
+        for(i = 1; i < n; ++i){
+            float *src = bufs[k][i] + start;
+            axpy_cpu(len, 1, src, 1, dst, 1);
+            fill_cpu(len, 0, src, 1);
+        }
+    }
+
+    for(k = 0; k < nbuf; ++k) free(bufs[k]);
+    free(bufs);
+    free(sizes);
+    free(first);
+}
+
+/* every replica keeps its own batchnorm rolling statistics from the images
+ * it saw, they are averaged after each round so the ones nets[0] saves
+ * cover all the images and the replicas start the next round alike */
+static void average_replica_statistics(network **nets, int n)
+{
+    layer *units[MAX_WEIGHT_UNITS], *rep[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS], **rptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS], rcounts[MAX_UNIT_TENSORS];
+    int i, j, u, k;
+    for(j = 0; j < nets[0]->n; ++j){
+        int nu = weight_units(nets[0]->layers + j, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k){
+                if(ptrs[k] != &units[u]->rolling_mean && ptrs[k] != &units[u]->rolling_variance) continue;
+                for(i = 1; i < n; ++i){
+                    weight_units(nets[i]->layers + j, rep);
+                    unit_tensors(rep[u], rptrs, rcounts);
+                    axpy_cpu(counts[k], 1, *rptrs[k], 1, *ptrs[k], 1);
+                }
+                scal_cpu(counts[k], 1./n, *ptrs[k], 1);
+                for(i = 1; i < n; ++i){
+                    weight_units(nets[i]->layers + j, rep);
+                    unit_tensors(rep[u], rptrs, rcounts);
+                    copy_cpu(counts[k], *ptrs[k], 1, *rptrs[k], 1);
+                }
+            }
+        }
+    }
+}
+
+float train_network_replicas(network **nets, int n, data d)
+{
+    network *net = nets[0];
+    int imgs = net->batch*net->subdivisions;
+    assert(d.X.rows % (imgs*n) == 0);
+    int rounds = d.X.rows / (imgs*n);
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int i, r;
+    float sum = 0;
+    pthread_t *threads = calloc(n, sizeof(pthread_t));
+    replica_args *args = calloc(n, sizeof(replica_args));
+    for(r = 0; r < rounds; ++r){
+        for(i = 0; i < n; ++i){
+            args[i].net = nets[i];
+            args[i].d = d;
+            args[i].offset = (r*n + i)*imgs;
+            args[i].threads = cores/n > 1 ? cores/n : 1;
+            if(pthread_create(threads + i, 0, replica_thread, args + i)) error("Thread creation failed");
+        }
+        for(i = 0; i < n; ++i){
+            pthread_join(threads[i], 0);
+            sum += args[i].err;
+        }
+        reduce_replicas(nets, n);
+        average_replica_statistics(nets, n);
+        /* each replica counted only its own images, the schedule follows
+         * all of them as sync_nets does on the gpu */
+        *net->seen += (n - 1)*imgs;
+        for(i = 1; i < n; ++i) *nets[i]->seen = *net->seen;
+        update_network_batch(net, imgs*n);
+    }
+    free(threads);
+    free(args);
+    return sum/d.X.rows;
+}
+
+/* data parallel training across processes. every rank starts from the
+ * parameters and the schedule position of rank 0, after that they stay in
+ * lockstep since every update applies the same reduced gradients */
+void join_ring(network *net, ring *r)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    int i, u, k;
+#ifdef GPU
+    if(net->gpu_index >= 0) error("Ring training runs on the cpu");
+#endif
+    net->ring = r;
+    ring_broadcast(r, net->seen, sizeof(size_t));
+    ring_broadcast(r, net->t, sizeof(int));
+    for(i = 0; i < net->n; ++i){
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k) ring_broadcast(r, *ptrs[k], counts[k]*sizeof(float));
+        }
+    }
+    if(r->rank) clear_network_updates(net);
+}
+
 void set_temp_network(network *net, float t)
 {
     int i;
@@ -361,6 +856,9 @@ void set_batch_network(network *net, int b)
         }
 #endif
     }
+    unplan_routes(net);
+    plan_routes(net);
+    net->output = get_network_output_layer(net).output;
 }
 
 int resize_network(network *net, int w, int h)
@@ -377,9 +875,12 @@ int resize_network(network *net, int w, int h)
     size_t workspace_size = 0;
     //fprintf(stderr, "Resizing to %d x %d...\n", w, h);
     //fflush(stderr);
+    unplan_routes(net);
     for (i = 0; i < net->n; ++i){
         layer l = net->layers[i];
-        if(l.type == CONVOLUTIONAL){
+        if(l.skipped){
+            /* nothing after a skipped layer reads its shape */
+        }else if(l.type == CONVOLUTIONAL){
             resize_convolutional_layer(&l, w, h);
         }else if(l.type == CROP){
             resize_crop_layer(&l, w, h);
@@ -414,6 +915,8 @@ int resize_network(network *net, int w, int h)
         h = l.out_h;
         if(l.type == AVGPOOL) break;
     }
+    net->batch_capacity = net->batch;
+    plan_routes(net);
     layer out = get_network_output_layer(net);
     net->inputs = net->layers[0].inputs;
     net->outputs = out.outputs;
@@ -531,22 +1034,32 @@ int num_detections(network *net, float thresh)
     return s;
 }
 
-detection *make_network_boxes(network *net, float thresh, int *num)
+/* the detections, their class probabilities and their masks live in one
+ * allocation so a frame costs a single calloc however many boxes it has */
+detection *make_detections(int n, int classes, int coords)
 {
-    layer l = net->layers[net->n - 1];
     int i;
-    int nboxes = num_detections(net, thresh);
-    if(num) *num = nboxes;
-    detection *dets = calloc(nboxes, sizeof(detection));
-    for(i = 0; i < nboxes; ++i){
-        dets[i].prob = calloc(l.classes, sizeof(float));
-        if(l.coords > 4){
-            dets[i].mask = calloc(l.coords-4, sizeof(float));
+    int masks = coords > 4 ? coords - 4 : 0;
+    detection *dets = calloc(1, n*sizeof(detection) + n*(classes + masks)*sizeof(float));
+    float *probs = (float *)(dets + n);
+    float *mask = probs + n*classes;
+    for(i = 0; i < n; ++i){
+        dets[i].prob = probs + i*classes;
+        if(masks){
+            dets[i].mask = mask + i*masks;
         }
     }
     return dets;
 }
 
+detection *make_network_boxes(network *net, float thresh, int *num)
+{
+    layer l = net->layers[net->n - 1];
+    int nboxes = num_detections(net, thresh);
+    if(num) *num = nboxes;
+    return make_detections(nboxes, l.classes, l.coords);
+}
+
 void fill_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
 {
     int j;
@@ -554,6 +1067,7 @@ void fill_network_boxes(network *net, int w, int h, float thresh, float hier, in
         layer l = net->layers[j];
         if(l.type == YOLO){
             int count = get_yolo_detections(l, w, h, net->w, net->h, thresh, map, relative, dets);
+            if(l.pre_nms_class_topk > 0) topk_detections(dets, count, l.classes, 0, l.pre_nms_class_topk);
             dets += count;
         }
         if(l.type == REGION){
@@ -571,16 +1085,66 @@ detection *get_network_boxes(network *net, int w, int h, float thresh, float hie
 {
     detection *dets = make_network_boxes(net, thresh, num);
     fill_network_boxes(net, w, h, thresh, hier, map, relative, dets);
+    int i;
+    for(i = 0; num && i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == YOLO && l.pre_nms_class_topk > 0){
+            *num = topk_detections(dets, *num, l.classes, 0, 0);
+            break;
+        }
+    }
     return dets;
 }
 
-void free_detections(detection *dets, int n)
+/* boxes for image b of a batched forward pass. the output layers are viewed
+ * through a shallow copy of the network that points at image b and looks like
+ * batch 1, so the flip averaging meant for batch 2 never kicks in */
+detection *get_network_boxes_batch(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num)
 {
     int i;
-    for(i = 0; i < n; ++i){
-        free(dets[i].prob);
-        if(dets[i].mask) free(dets[i].mask);
+    network view = *net;
+    view.layers = calloc(net->n, sizeof(layer));
+    memcpy(view.layers, net->layers, net->n*sizeof(layer));
+    for(i = 0; i < net->n; ++i){
+        layer *l = view.layers + i;
+        if(l->type == YOLO || l->type == REGION || l->type == DETECTION){
+            l->output += b*l->outputs;
+            l->batch = 1;
+        }
     }
+    detection *dets = get_network_boxes(&view, w, h, thresh, hier, map, relative, num);
+    free(view.layers);
+    return dets;
+}
+
+/* hands every box above thresh to handler as it is decoded instead of
+ * materializing them all. the detection passed to handler is only valid for
+ * the duration of the call */
+void stream_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection_handler handler, void *ctx)
+{
+    int j, i;
+    for(j = 0; j < net->n; ++j){
+        layer l = net->layers[j];
+        if(l.type == YOLO){
+            stream_yolo_detections(l, w, h, net->w, net->h, thresh, relative, handler, ctx);
+        }
+        if(l.type == REGION){
+            stream_region_detections(l, w, h, net->w, net->h, thresh, map, hier, relative, handler, ctx);
+        }
+        if(l.type == DETECTION){
+            int n = l.w*l.h*l.n;
+            detection *dets = make_detections(n, l.classes, l.coords);
+            get_detection_detections(l, w, h, thresh, dets);
+            for(i = 0; i < n; ++i){
+                if(dets[i].objectness > thresh) handler(dets + i, ctx);
+            }
+            free_detections(dets, n);
+        }
+    }
+}
+
+void free_detections(detection *dets, int n)
+{
     free(dets);
 }
 
@@ -724,10 +1288,13 @@ float network_accuracy_multi(network *net, data d, int n)
 void free_network(network *net)
 {
     int i;
+    unmap_weights(net);
+    if(net->param_arena) free_network_arena(net);
     for(i = 0; i < net->n; ++i){
         free_layer(net->layers[i]);
     }
     free(net->layers);
+    if(net->cfgfile) free(net->cfgfile);
     if(net->input) free(net->input);
     if(net->truth) free(net->truth);
 #ifdef GPU
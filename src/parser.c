@@ -2,6 +2,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "activation_layer.h"
 #include "logistic_layer.h"
@@ -36,6 +41,7 @@
 #include "softmax_layer.h"
 #include "lstm_layer.h"
 #include "utils.h"
+#include "queue.h"
 
 typedef struct{
     char *type;
@@ -43,6 +49,8 @@ typedef struct{
 }section;
 
 list *read_cfg(char *filename);
+static FILE *open_plan_cfg(char *filename);
+static int stored_unit_tensors(layer *u, float ***ptrs, int *counts);
 
 LAYER_TYPE string_to_layer_type(char * type)
 {
@@ -126,6 +134,7 @@ typedef struct size_params{
     int c;
     int index;
     int time_steps;
+    int init;
     network *net;
 } size_params;
 
@@ -145,7 +154,7 @@ local_layer parse_local(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before local layer must output image.");
 
-    local_layer layer = make_local_layer(batch,h,w,c,n,size,stride,pad,activation);
+    local_layer layer = make_local_layer(batch,h,w,c,n,size,stride,pad,activation, params.init);
 
     return layer;
 }
@@ -170,7 +179,7 @@ layer parse_deconvolutional(list *options, size_params params)
     int padding = option_find_int_quiet(options, "padding",0);
     if(pad) padding = size/2;
 
-    layer l = make_deconvolutional_layer(batch,h,w,c,n,size,stride,padding, activation, batch_normalize, params.net->adam);
+    layer l = make_deconvolutional_layer(batch,h,w,c,n,size,stride,padding, activation, batch_normalize, params.net->adam, params.init);
 
     return l;
 }
@@ -199,7 +208,7 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     int binary = option_find_int_quiet(options, "binary", 0);
     int xnor = option_find_int_quiet(options, "xnor", 0);
 
-    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam);
+    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam, params.init);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
 
@@ -263,7 +272,7 @@ layer parse_connected(list *options, size_params params)
     ACTIVATION activation = get_activation(activation_s);
     int batch_normalize = option_find_int_quiet(options, "batch_normalize", 0);
 
-    layer l = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize, params.net->adam);
+    layer l = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize, params.net->adam, params.init);
     return l;
 }
 
@@ -339,6 +348,10 @@ layer parse_yolo(list *options, size_params params)
     }
     /* end add */
 
+    l.pre_nms_topk = option_find_int_quiet(options, "pre_nms_topk", 0);
+    l.pre_nms_class_topk = option_find_int_quiet(options, "pre_nms_class_topk", 0);
+    l.max_detections = option_find_int_quiet(options, "max_detections", 0);
+
     l.max_boxes = option_find_int_quiet(options, "max",90);
     l.jitter = option_find_float(options, "jitter", .2);
 
@@ -696,6 +709,7 @@ void parse_net_options(list *options, network *net)
     net->subdivisions = subdivs;
     net->random = option_find_int_quiet(options, "random", 0);
 
+    net->arena = option_find_int_quiet(options, "arena", 0);
     net->adam = option_find_int_quiet(options, "adam", 0);
     if(net->adam){
         net->B1 = option_find_float(options, "B1", .9);
@@ -735,7 +749,7 @@ void parse_net_options(list *options, network *net)
         if (cls_w[j] == ',')
             ++n_cls_w;
     }
-    float *class_weights = calloc(n_cls_w, sizeof(float));
+    float *class_weights = calloc(n_cls_w + 1, sizeof(float));
     for (j = 0; j < n_cls_w; ++j)
     {
         class_weights[j] = atof(cls_w);
@@ -798,10 +812,171 @@ int is_network(section *s)
 
 network *parse_network_cfg(char *filename)
 {
-    list *sections = read_cfg(filename);
+    return parse_network_cfg_batch(filename, 0);
+}
+
+/* marks the layers the output of layer output depends on. layers only ever
+ * read from earlier layers, so walking back from output and following the
+ * route and shortcut references is enough */
+static int *layer_ancestors(list *sections, int output)
+{
+    int i, j;
+    int *needed = calloc(output + 1, sizeof(int));
+    section **ss = (section **)list_to_array(sections);
+    needed[output] = 1;
+    for(i = output; i >= 0; --i){
+        if(!needed[i]) continue;
+        section *s = ss[i + 1];
+        LAYER_TYPE lt = string_to_layer_type(s->type);
+        char *refs = 0;
+        if(lt == ROUTE) refs = option_find(s->options, "layers");
+        if(lt == SHORTCUT) refs = option_find(s->options, "from");
+        if(lt != ROUTE && i > 0) needed[i-1] = 1;
+        while(refs){
+            j = atoi(refs);
+            if(j < 0) j = i + j;
+            if(j >= 0 && j < i) needed[j] = 1;
+            refs = strchr(refs, ',');
+            if(refs) ++refs;
+        }
+    }
+    free(ss);
+    return needed;
+}
+
+static void skipped_layer_pass(layer l, network net)
+{
+}
+
+/* the layers backbones are made of, parse_skipped sizes them unbuilt */
+static int can_skip_unbuilt(LAYER_TYPE lt)
+{
+    return lt == CONVOLUTIONAL || lt == CONNECTED || lt == MAXPOOL;
+}
+
+/* the shape of a layer the output doesn't need, worked out from its options
+ * without building it. the other layer types are built and released again
+ * by skip_layer */
+static layer parse_skipped(LAYER_TYPE lt, list *options, size_params params)
+{
+    layer l = {0};
+    l.type = lt;
+    l.batch = params.batch;
+    l.h = params.h;
+    l.w = params.w;
+    l.c = params.c;
+    l.inputs = params.inputs;
+    if(lt == CONVOLUTIONAL){
+        l.n = option_find_int(options, "filters",1);
+        l.size = option_find_int(options, "size",1);
+        l.stride = option_find_int(options, "stride",1);
+        int pad = option_find_int_quiet(options, "pad",0);
+        l.pad = option_find_int_quiet(options, "padding",0);
+        l.groups = option_find_int_quiet(options, "groups", 1);
+        if(pad) l.pad = l.size/2;
+        if(!(l.h && l.w && l.c)) error("Layer before convolutional layer must output image.");
+        option_find_str(options, "activation", "logistic");
+        l.batch_normalize = option_find_int_quiet(options, "batch_normalize", 0);
+        option_find_int_quiet(options, "binary", 0);
+        option_find_int_quiet(options, "xnor", 0);
+        option_find_int_quiet(options, "flipped", 0);
+        option_find_float_quiet(options, "dot", 0);
+        l.out_h = convolutional_out_height(l);
+        l.out_w = convolutional_out_width(l);
+        l.out_c = l.n;
+        l.nweights = l.c/l.groups*l.n*l.size*l.size;
+        l.nbiases = l.n;
+    }else if(lt == CONNECTED){
+        l.outputs = option_find_int(options, "output",1);
+        option_find_str(options, "activation", "logistic");
+        l.batch_normalize = option_find_int_quiet(options, "batch_normalize", 0);
+        l.h = 1;
+        l.w = 1;
+        l.c = l.inputs;
+        l.out_h = 1;
+        l.out_w = 1;
+        l.out_c = l.outputs;
+    }else if(lt == MAXPOOL){
+        l.stride = option_find_int(options, "stride",1);
+        l.size = option_find_int(options, "size",l.stride);
+        l.pad = option_find_int_quiet(options, "padding", l.size-1);
+        if(!(l.h && l.w && l.c)) error("Layer before maxpool layer must output image.");
+        l.out_w = (l.w + l.pad - l.size)/l.stride + 1;
+        l.out_h = (l.h + l.pad - l.size)/l.stride + 1;
+        l.out_c = l.c;
+    }
+    l.outputs = l.out_h*l.out_w*l.out_c;
+    fprintf(stderr, "skip                     %4d x%4d x%4d   ->  %4d x%4d x%4d\n", l.w, l.h, l.c, l.out_w, l.out_h, l.out_c);
+    return l;
+}
+
+/* what is left of a layer the output doesn't need: a BLANK that only keeps
+ * its shape, for the layers after it, and how many bytes of the weights file
+ * are its, for the loaders to step over. everything that works on layer
+ * types passes over it */
+static layer skip_layer(layer l)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    int u, k;
+    layer s = {0};
+    s.type = BLANK;
+    s.skipped = 1;
+    s.batch = l.batch;
+    s.inputs = l.inputs;
+    s.outputs = l.outputs;
+    s.h = l.h;
+    s.w = l.w;
+    s.c = l.c;
+    s.out_h = l.out_h;
+    s.out_w = l.out_w;
+    s.out_c = l.out_c;
+    s.dontload = l.dontload;
+    s.dontsave = l.dontsave;
+    int nu = weight_units(&l, units);
+    for(u = 0; u < nu; ++u){
+        int nt = stored_unit_tensors(units[u], ptrs, counts);
+        for(k = 0; k < nt; ++k) s.skipped_bytes += counts[k]*sizeof(float);
+    }
+    s.forward = skipped_layer_pass;
+    s.backward = skipped_layer_pass;
+    s.forward_gpu = skipped_layer_pass;
+    s.backward_gpu = skipped_layer_pass;
+    free_layer(l);
+    return s;
+}
+
+/* max_detections is read off the last layer, so the heads agree on one value:
+ * the largest one set on any of them */
+static void share_max_detections(network *net)
+{
+    int i;
+    int max_dets = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != YOLO || !l.max_detections) continue;
+        if(max_dets && l.max_detections != max_dets){
+            fprintf(stderr, "Warning: [yolo] layers set different max_detections, using the largest\n");
+        }
+        if(l.max_detections > max_dets) max_dets = l.max_detections;
+    }
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type == YOLO) net->layers[i].max_detections = max_dets;
+    }
+}
+
+/* builds the first nlayers layers of the cfg. when needed is given the
+ * layers it doesn't mark are skipped: the common ones are never built, the
+ * others are built without initializing their weights and released right
+ * away, so the network only holds the layers the output depends on. without
+ * init no weights are initialized, for callers that point them elsewhere */
+static network *parse_network_sections(list *sections, int batch, int nlayers, int *needed, int init)
+{
     node *n = sections->front;
     if(!n) error("Config file has no sections");
-    network *net = make_network(sections->size - 1);
+    if(nlayers <= 0 || nlayers > sections->size - 1) nlayers = sections->size - 1;
+    network *net = make_network(nlayers);
     net->gpu_index = gpu_index;
     size_params params;
 
@@ -809,6 +984,7 @@ network *parse_network_cfg(char *filename)
     list *options = s->options;
     if(!is_network(s)) error("First section must be [net] or [network]");
     parse_net_options(options, net);
+    if(batch > 0) net->batch = batch;
 
     params.h = net->h;
     params.w = net->w;
@@ -823,14 +999,18 @@ network *parse_network_cfg(char *filename)
     int count = 0;
     free_section(s);
     fprintf(stderr, "layer     filters    size              input                output\n");
-    while(n){
+    while(n && count < nlayers){
         params.index = count;
         fprintf(stderr, "%5d ", count);
         s = (section *)n->val;
         options = s->options;
         layer l = {0};
         LAYER_TYPE lt = string_to_layer_type(s->type);
-        if(lt == CONVOLUTIONAL){
+        int skipped = needed && !needed[count] && lt != RNN && lt != GRU && lt != LSTM && lt != CRNN;
+        params.init = init && !skipped;
+        if(skipped && can_skip_unbuilt(lt)){
+            l = parse_skipped(lt, options, params);
+        }else if(lt == CONVOLUTIONAL){
             l = parse_convolutional(options, params);
         }else if(lt == DECONVOLUTIONAL){
             l = parse_deconvolutional(options, params);
@@ -905,6 +1085,9 @@ network *parse_network_cfg(char *filename)
         l.learning_rate_scale = option_find_float_quiet(options, "learning_rate", 1);
         l.smooth = option_find_float_quiet(options, "smooth", 0);
         option_unused(options);
+        if(skipped){
+            l = skip_layer(l);
+        }
         net->layers[count] = l;
         if (l.workspace_size > workspace_size) workspace_size = l.workspace_size;
         free_section(s);
@@ -917,7 +1100,15 @@ network *parse_network_cfg(char *filename)
             params.inputs = l.outputs;
         }
     }
+    while(n){
+        free_section((section *)n->val);
+        n = n->next;
+    }
     free_list(sections);
+    share_max_detections(net);
+    if(net->arena) pack_network_arena(net);
+    net->batch_capacity = net->batch;
+    plan_routes(net);
     layer out = get_network_output_layer(net);
     net->outputs = out.outputs;
     net->truths = out.outputs;
@@ -945,10 +1136,41 @@ network *parse_network_cfg(char *filename)
     return net;
 }
 
-list *read_cfg(char *filename)
+/* only the layers before cutoff, the weights of a truncated network load from
+ * the front of the full weights file */
+network *parse_network_cfg_upto(char *filename, int cutoff)
+{
+    list *sections = read_cfg(filename);
+    network *net = parse_network_sections(sections, 0, cutoff, 0, 1);
+    net->cfgfile = copy_string(filename);
+    return net;
+}
+
+/* the network truncated after layer output, with the layers output does not
+ * depend on left unbuilt */
+network *parse_network_cfg_for_output(char *filename, int output)
+{
+    list *sections = read_cfg(filename);
+    if(output < 0 || output >= sections->size - 1) error("Output layer is not in the network");
+    int *needed = layer_ancestors(sections, output);
+    network *net = parse_network_sections(sections, 0, output + 1, needed, 1);
+    free(needed);
+    net->cfgfile = copy_string(filename);
+    return net;
+}
+
+/* builds the network for batch images per forward pass instead of the batch
+ * the cfg asks for. batch <= 0 keeps the cfg value */
+network *parse_network_cfg_batch(char *filename, int batch)
+{
+    list *sections = read_cfg(filename);
+    network *net = parse_network_sections(sections, batch, 0, 0, 1);
+    net->cfgfile = copy_string(filename);
+    return net;
+}
+
+static list *read_cfg_file(FILE *file)
 {
-    FILE *file = fopen(filename, "r");
-    if(file == 0) file_error(filename);
     char *line;
     int nu = 0;
     list *options = make_list();
@@ -976,6 +1198,15 @@ list *read_cfg(char *filename)
                 break;
         }
     }
+    return options;
+}
+
+list *read_cfg(char *filename)
+{
+    FILE *file = open_plan_cfg(filename);
+    if(!file) file = fopen(filename, "r");
+    if(file == 0) file_error(filename);
+    list *options = read_cfg_file(file);
     fclose(file);
     return options;
 }
@@ -1071,7 +1302,13 @@ void save_weights_upto(network *net, char *filename, int cutoff)
     fprintf(stderr, "Saving weights to %s\n", filename);
     FILE *fp = fopen(filename, "wb");
     if(!fp) file_error(filename);
+    write_weights_upto(net, fp, cutoff);
+    fclose(fp);
+}
 
+/* the classic weights format, the layers before cutoff */
+void write_weights_upto(network *net, FILE *fp, int cutoff)
+{
     int major = 0;
     int minor = 2;
     int revision = 0;
@@ -1084,6 +1321,7 @@ void save_weights_upto(network *net, char *filename, int cutoff)
     for(i = 0; i < net->n && i < cutoff; ++i){
         layer l = net->layers[i];
         if (l.dontsave) continue;
+        if(l.skipped) error("Cannot save the weights of a network built for one output");
         if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
             save_convolutional_weights(l, fp);
         } if(l.type == CONNECTED){
@@ -1132,7 +1370,6 @@ void save_weights_upto(network *net, char *filename, int cutoff)
             fwrite(l.weights, sizeof(float), size, fp);
         }
     }
-    fclose(fp);
 }
 void save_weights(network *net, char *filename)
 {
@@ -1272,6 +1509,654 @@ void load_convolutional_weights(layer l, FILE *fp)
 }
 
 
+/* mapped weights: a header, a table with one entry per tensor and the tensors
+ * themselves, each 64 byte aligned and already in the layout the layers run
+ * on, so loading is an mmap plus pointing the layers into it. the mapping is
+ * private, pages are shared between processes until one of them writes.
+ * the fields are fixed width but, like the floats, in the byte order of the
+ * machine that wrote them: the files are only portable between hosts of the
+ * same endianness */
+
+#define MAPPED_WEIGHTS_MAGIC "DNWMAP01"
+#define MAPPED_WEIGHTS_ALIGN 64
+
+typedef struct{
+    char magic[8];
+    int32_t layers;
+    int32_t tensors;
+    uint64_t seen;
+    uint64_t size;
+} mapped_weights_header;
+
+typedef struct{
+    int32_t layer;
+    int32_t count;
+    uint64_t offset;
+} mapped_weights_tensor;
+
+/* the layers that actually hold weights, recurrent layers keep theirs in
+ * their gate layers */
+int weight_units(layer *l, layer **units)
+{
+    switch(l->type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+        case CONNECTED:
+        case BATCHNORM:
+        case LOCAL:
+            units[0] = l;
+            return 1;
+        case CRNN:
+        case RNN:
+            units[0] = l->input_layer;
+            units[1] = l->self_layer;
+            units[2] = l->output_layer;
+            return 3;
+        case LSTM:
+            units[0] = l->wi;
+            units[1] = l->wf;
+            units[2] = l->wo;
+            units[3] = l->wg;
+            units[4] = l->ui;
+            units[5] = l->uf;
+            units[6] = l->uo;
+            units[7] = l->ug;
+            return 8;
+        case GRU:
+            units[0] = l->wz;
+            units[1] = l->wr;
+            units[2] = l->wh;
+            units[3] = l->uz;
+            units[4] = l->ur;
+            units[5] = l->uh;
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+int unit_tensors(layer *u, float ***ptrs, int *counts)
+{
+    int k = 0;
+    int n = (u->type == CONNECTED || u->type == LOCAL) ? u->outputs : (u->type == BATCHNORM) ? u->c : u->n;
+    if(u->type != BATCHNORM){
+        ptrs[k] = &u->biases;
+        counts[k++] = n;
+        ptrs[k] = &u->weights;
+        counts[k++] = (u->type == LOCAL) ? u->size*u->size*u->c*u->n*u->out_w*u->out_h : (u->type == CONNECTED) ? u->outputs*u->inputs : u->nweights;
+    }
+    if(u->batch_normalize || u->type == BATCHNORM){
+        ptrs[k] = &u->scales;
+        counts[k++] = n;
+        ptrs[k] = &u->rolling_mean;
+        counts[k++] = n;
+        ptrs[k] = &u->rolling_variance;
+        counts[k++] = n;
+    }
+    return k;
+}
+
+/* the gradient buffers of a unit, in the order unit_tensors keeps the
+ * parameters they belong to */
+int unit_updates(layer *u, float ***ptrs, int *counts)
+{
+    int k = 0;
+    int n = (u->type == CONNECTED || u->type == LOCAL) ? u->outputs : (u->type == BATCHNORM) ? u->c : u->n;
+    if(u->type != BATCHNORM){
+        ptrs[k] = &u->bias_updates;
+        counts[k++] = n;
+        ptrs[k] = &u->weight_updates;
+        counts[k++] = (u->type == LOCAL) ? u->size*u->size*u->c*u->n*u->out_w*u->out_h : (u->type == CONNECTED) ? u->outputs*u->inputs : u->nweights;
+    }
+    if(u->batch_normalize || u->type == BATCHNORM){
+        ptrs[k] = &u->scale_updates;
+        counts[k++] = n;
+    }
+    return k;
+}
+
+/* tensors packed into the parameter arena go with it */
+static void release_tensor(network *net, float *p)
+{
+    if(net->param_arena && p >= net->param_arena && p < net->param_arena + net->param_arena_size) return;
+    free(p);
+}
+
+static size_t align_weights(size_t offset)
+{
+    return (offset + MAPPED_WEIGHTS_ALIGN - 1) & ~(size_t)(MAPPED_WEIGHTS_ALIGN - 1);
+}
+
+/* writes the mapped weights at the current position of fp, the offsets in
+ * the table are relative to that position */
+static void write_mapped_weights(network *net, FILE *fp)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    int i, u, k;
+    long base = ftell(fp);
+    int tensors = 0;
+    for(i = 0; i < net->n; ++i){
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u) tensors += unit_tensors(units[u], ptrs, counts);
+    }
+    mapped_weights_tensor *table = calloc(tensors, sizeof(mapped_weights_tensor));
+    size_t offset = align_weights(sizeof(mapped_weights_header) + tensors*sizeof(mapped_weights_tensor));
+    int t = 0;
+    for(i = 0; i < net->n; ++i){
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k){
+                table[t].layer = i;
+                table[t].count = counts[k];
+                table[t].offset = offset;
+                offset = align_weights(offset + counts[k]*sizeof(float));
+                ++t;
+            }
+        }
+    }
+
+    mapped_weights_header header = {{0}};
+    memcpy(header.magic, MAPPED_WEIGHTS_MAGIC, sizeof(header.magic));
+    header.layers = net->n;
+    header.tensors = tensors;
+    header.seen = *net->seen;
+    header.size = offset;
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(table, sizeof(mapped_weights_tensor), tensors, fp);
+
+    static const char zeros[MAPPED_WEIGHTS_ALIGN] = {0};
+    t = 0;
+    for(i = 0; i < net->n; ++i){
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k){
+                long pos = ftell(fp) - base;
+                fwrite(zeros, 1, table[t].offset - pos, fp);
+                fwrite(*ptrs[k], sizeof(float), counts[k], fp);
+                ++t;
+            }
+        }
+    }
+    fwrite(zeros, 1, header.size - (ftell(fp) - base), fp);
+    free(table);
+}
+
+void save_weights_mapped(network *net, char *filename)
+{
+    fprintf(stderr, "Saving mapped weights to %s\n", filename);
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    write_mapped_weights(net, fp);
+    fclose(fp);
+}
+
+int is_mapped_weights(char *filename)
+{
+    char magic[8] = {0};
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    int ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && 0 == memcmp(magic, MAPPED_WEIGHTS_MAGIC, sizeof(magic));
+    fclose(fp);
+    return ok;
+}
+
+#ifdef GPU
+static void push_weight_unit(layer *u)
+{
+    if(u->type == CONVOLUTIONAL || u->type == DECONVOLUTIONAL) push_convolutional_layer(*u);
+    if(u->type == CONNECTED) push_connected_layer(*u);
+    if(u->type == BATCHNORM) push_batchnorm_layer(*u);
+    if(u->type == LOCAL) push_local_layer(*u);
+}
+#endif
+
+/* points the layers in [start, cutoff) at the tensors of the mapped weights
+ * section, which has to live inside net->weights_map */
+static void bind_mapped_weights(network *net, char *section, size_t size, int start, int cutoff)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    int i, u, k;
+    mapped_weights_header *header = (mapped_weights_header *)section;
+    mapped_weights_tensor *table = (mapped_weights_tensor *)(header + 1);
+    if(size < sizeof(mapped_weights_header) || memcmp(header->magic, MAPPED_WEIGHTS_MAGIC, sizeof(header->magic))
+            || header->size != size || header->layers != net->n){
+        error("Mapped weights do not match the network");
+    }
+    if(header->tensors < 0 || header->tensors > (size - sizeof(mapped_weights_header))/sizeof(mapped_weights_tensor)){
+        error("Mapped weights are corrupt");
+    }
+    int t;
+    for(t = 0; t < header->tensors; ++t){
+        if(table[t].count < 0 || table[t].offset % MAPPED_WEIGHTS_ALIGN || table[t].offset > size
+                || table[t].count > (size - table[t].offset)/sizeof(float)){
+            error("Mapped weights are corrupt");
+        }
+    }
+    *net->seen = header->seen;
+
+    t = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->skipped){
+            while(t < header->tensors && table[t].layer == i) ++t;
+            continue;
+        }
+        int bind = i >= start && i < cutoff && !l->dontload;
+        int nu = weight_units(l, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k, ++t){
+                if(t >= header->tensors || table[t].layer != i || table[t].count != counts[k]){
+                    error("Mapped weights do not match the network");
+                }
+                if(!bind) continue;
+                release_tensor(net, *ptrs[k]);
+                *ptrs[k] = (float *)(section + table[t].offset);
+            }
+#ifdef GPU
+            if(bind && gpu_index >= 0) push_weight_unit(units[u]);
+#endif
+        }
+    }
+    if(t != header->tensors) error("Mapped weights do not match the network");
+}
+
+static char *map_file(char *filename, size_t *size)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st)) file_error(filename);
+    char *map = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) file_error(filename);
+    *size = st.st_size;
+    return map;
+}
+
+void load_weights_mapped(network *net, char *filename, int start, int cutoff)
+{
+    size_t size;
+    if(net->weights_map) error("Network already has mapped weights");
+    fprintf(stderr, "Mapping weights from %s...", filename);
+    char *map = map_file(filename, &size);
+    net->weights_map = map;
+    net->weights_map_size = size;
+    bind_mapped_weights(net, map, size, start, cutoff);
+    fprintf(stderr, "Done!\n");
+}
+
+/* points every parameter tensor that lies in [base, base + size) at nothing,
+ * so free_layer leaves it to whoever owns it. a NULL base detaches all the
+ * ones a clone shares, its rolling statistics are its own */
+static void detach_weights(network *net, char *base, size_t size)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    int i, u, k;
+    for(i = 0; i < net->n; ++i){
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k){
+                char *p = (char *)*ptrs[k];
+                if(!base && (ptrs[k] == &units[u]->rolling_mean || ptrs[k] == &units[u]->rolling_variance)) continue;
+                if(!base || (p >= base && p < base + size)) *ptrs[k] = 0;
+            }
+        }
+    }
+}
+
+/* detaches the layers from the mapping so free_layer doesn't free into it */
+void unmap_weights(network *net)
+{
+    char *map = net->weights_map;
+    if(net->shared_weights){
+        detach_weights(net, 0, 0);
+        net->shared_weights = 0;
+    }
+    if(!map) return;
+    detach_weights(net, map, net->weights_map_size);
+    munmap(map, net->weights_map_size);
+    net->weights_map = 0;
+    net->weights_map_size = 0;
+}
+
+/* a second network built from the same cfg that runs with its own
+ * activations, workspace and gradients but reads the parameters of src in
+ * place, so N contexts cost one copy of the model. src owns the parameters
+ * and has to outlive its clones. a clone can run forward and backward but
+ * only src may update, the rolling statistics are copied since batchnorm
+ * writes them on every training pass */
+network *clone_network_shared(network *src, int batch)
+{
+    layer *su[MAX_WEIGHT_UNITS], *du[MAX_WEIGHT_UNITS];
+    float **sp[MAX_UNIT_TENSORS], **dp[MAX_UNIT_TENSORS];
+    int sc[MAX_UNIT_TENSORS], dc[MAX_UNIT_TENSORS];
+    int i, u, k;
+    if(!src->cfgfile) error("Network has no cfg to clone from");
+    list *sections = read_cfg(src->cfgfile);
+    network *net = parse_network_sections(sections, batch > 0 ? batch : src->batch, 0, 0, 0);
+    net->cfgfile = copy_string(src->cfgfile);
+    if(net->n != src->n) error("Clone does not match its source network");
+    *net->seen = *src->seen;
+    for(i = 0; i < net->n; ++i){
+        int nu = weight_units(src->layers + i, su);
+        if(weight_units(net->layers + i, du) != nu) error("Clone does not match its source network");
+        for(u = 0; u < nu; ++u){
+            int nt = unit_tensors(su[u], sp, sc);
+            if(unit_tensors(du[u], dp, dc) != nt) error("Clone does not match its source network");
+            for(k = 0; k < nt; ++k){
+                if(sc[k] != dc[k]) error("Clone does not match its source network");
+                if(dp[k] == &du[u]->rolling_mean || dp[k] == &du[u]->rolling_variance){
+                    memcpy(*dp[k], *sp[k], sc[k]*sizeof(float));
+                    continue;
+                }
+                release_tensor(net, *dp[k]);
+                *dp[k] = *sp[k];
+            }
+#ifdef GPU
+            if(gpu_index >= 0) push_weight_unit(du[u]);
+#endif
+        }
+    }
+    net->shared_weights = 1;
+    return net;
+}
+
+/* a compiled plan is the cfg text and the mapped weights of a network in one
+ * file, stamped with hashes of the cfg and weights it was built from and the
+ * cpu features of the machine that built it. loading one skips reading the
+ * cfg from disk, the random initialization of the weights and the weights
+ * file itself, the layers are built and pointed into the mapping. the header
+ * is fixed width, in the byte order of the machine that built the plan */
+
+#define PLAN_MAGIC "DNPLAN01"
+#define PLAN_ALIGN 4096
+
+typedef struct{
+    char magic[8];
+    int32_t features;
+    int32_t pad;
+    uint64_t cfg_hash;
+    uint64_t weights_hash;
+    uint64_t cfg_offset;
+    uint64_t cfg_size;
+    uint64_t weights_offset;
+    uint64_t size;
+} plan_header;
+
+static uint64_t hash_bytes(uint64_t hash, const char *p, size_t n)
+{
+    size_t i;
+    for(i = 0; i < n; ++i){
+        hash ^= (unsigned char)p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t hash_file(char *filename)
+{
+    char buf[1<<16];
+    size_t n;
+    uint64_t hash = 14695981039346656037ULL;
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) hash = hash_bytes(hash, buf, n);
+    fclose(fp);
+    return hash;
+}
+
+static int cpu_features()
+{
+    int features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")) features |= 1;
+    if(__builtin_cpu_supports("avx")) features |= 2;
+    if(__builtin_cpu_supports("avx2")) features |= 4;
+    if(__builtin_cpu_supports("fma")) features |= 8;
+    if(__builtin_cpu_supports("avx512f")) features |= 16;
+#endif
+    return features;
+}
+
+static size_t file_size(char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    fseek(fp, 0, SEEK_END);
+    size_t size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static int read_plan_header(char *filename, plan_header *header)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    int ok = fread(header, sizeof(plan_header), 1, fp) == 1 && 0 == memcmp(header->magic, PLAN_MAGIC, sizeof(header->magic));
+    fclose(fp);
+    return ok;
+}
+
+int is_plan(char *filename)
+{
+    plan_header header;
+    return read_plan_header(filename, &header);
+}
+
+/* the cfg text of a plan as a stream read_cfg can parse, so anything that
+ * reparses a network by its cfgfile works on plans too */
+static FILE *open_plan_cfg(char *filename)
+{
+    plan_header header;
+    if(!read_plan_header(filename, &header)) return 0;
+    char *cfg = calloc(header.cfg_size, 1);
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    fseek(fp, header.cfg_offset, SEEK_SET);
+    if(fread(cfg, 1, header.cfg_size, fp) != header.cfg_size) error("Compiled plan is truncated");
+    fclose(fp);
+    FILE *tmp = tmpfile();
+    fwrite(cfg, 1, header.cfg_size, tmp);
+    rewind(tmp);
+    free(cfg);
+    return tmp;
+}
+
+void compile_plan(char *cfgfile, char *weightfile, char *filename)
+{
+    plan_header header = {{0}};
+    plan_header old;
+    memcpy(header.magic, PLAN_MAGIC, sizeof(header.magic));
+    header.features = cpu_features();
+    header.cfg_hash = hash_file(cfgfile);
+    header.weights_hash = weightfile ? hash_file(weightfile) : 0;
+    if(read_plan_header(filename, &old) && old.size == file_size(filename) && old.features == header.features
+            && old.cfg_hash == header.cfg_hash && old.weights_hash == header.weights_hash){
+        fprintf(stderr, "%s is up to date\n", filename);
+        return;
+    }
+
+    network *net = load_network(cfgfile, weightfile, 0);
+    FILE *cfg = fopen(cfgfile, "rb");
+    if(!cfg) file_error(cfgfile);
+    fseek(cfg, 0, SEEK_END);
+    header.cfg_size = ftell(cfg);
+    rewind(cfg);
+    char *text = calloc(header.cfg_size, 1);
+    if(fread(text, 1, header.cfg_size, cfg) != header.cfg_size) file_error(cfgfile);
+    fclose(cfg);
+
+    fprintf(stderr, "Compiling plan to %s\n", filename);
+    char *tmp = calloc(strlen(filename) + 5, 1);
+    sprintf(tmp, "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "wb");
+    if(!fp) file_error(tmp);
+    static const char zeros[PLAN_ALIGN] = {0};
+    header.cfg_offset = sizeof(plan_header);
+    header.weights_offset = (header.cfg_offset + header.cfg_size + PLAN_ALIGN - 1) / PLAN_ALIGN * PLAN_ALIGN;
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(text, 1, header.cfg_size, fp);
+    fwrite(zeros, 1, header.weights_offset - ftell(fp), fp);
+    write_mapped_weights(net, fp);
+    header.size = ftell(fp);
+    rewind(fp);
+    fwrite(&header, sizeof(header), 1, fp);
+    int ok = !ferror(fp);
+    ok = !fflush(fp) && ok;
+    ok = !fsync(fileno(fp)) && ok;
+    ok = !fclose(fp) && ok;
+    if(!ok || rename(tmp, filename)){
+        unlink(tmp);
+        error("Couldn't write the compiled plan");
+    }
+    free(tmp);
+    free(text);
+    free_network(net);
+}
+
+network *load_plan(char *filename)
+{
+    size_t size;
+    double start = what_time_is_it_now();
+    char *map = map_file(filename, &size);
+    plan_header *header = (plan_header *)map;
+    if(size < sizeof(plan_header) || memcmp(header->magic, PLAN_MAGIC, sizeof(header->magic)) || header->size != size){
+        error("Not a compiled plan");
+    }
+    if(header->cfg_offset > size || header->cfg_size > size - header->cfg_offset
+            || header->weights_offset % PLAN_ALIGN || header->weights_offset > size){
+        error("Compiled plan is corrupt");
+    }
+    if(header->features != cpu_features()){
+        error("Plan was compiled on a cpu with different features, rerun darknet compile");
+    }
+    FILE *fp = fmemopen(map + header->cfg_offset, header->cfg_size, "r");
+    list *sections = read_cfg_file(fp);
+    fclose(fp);
+    network *net = parse_network_sections(sections, 0, 0, 0, 0);
+    net->cfgfile = copy_string(filename);
+    net->weights_map = map;
+    net->weights_map_size = size;
+    bind_mapped_weights(net, map + header->weights_offset, size - header->weights_offset, 0, net->n);
+    fprintf(stderr, "Loaded plan %s in %.3f seconds\n", filename, what_time_is_it_now() - start);
+    return net;
+}
+
+/* the tensors of one weight unit in the order the classic weights format
+ * stores them, honoring numload and dontloadscales the way the per layer
+ * loaders always have */
+static int stored_unit_tensors(layer *u, float ***ptrs, int *counts)
+{
+    int k = 0;
+    int n = u->n;
+    int num = 0;
+    if(u->type == CONVOLUTIONAL || u->type == DECONVOLUTIONAL){
+        int groups = u->groups > 0 ? u->groups : 1;
+        if(u->numload) n = u->numload;
+        num = u->c/groups*n*u->size*u->size;
+    } else if(u->type == CONNECTED || u->type == LOCAL){
+        n = u->outputs;
+        num = (u->type == LOCAL) ? u->size*u->size*u->c*u->n*u->out_w*u->out_h : u->outputs*u->inputs;
+    } else if(u->type == BATCHNORM){
+        n = u->c;
+    }
+    int scales = (u->type == BATCHNORM) || (u->type != LOCAL && u->batch_normalize && !u->dontloadscales);
+    if(u->type != BATCHNORM){
+        ptrs[k] = &u->biases;
+        counts[k++] = n;
+    }
+    if(u->type == CONNECTED){
+        ptrs[k] = &u->weights;
+        counts[k++] = num;
+    }
+    if(scales){
+        ptrs[k] = &u->scales;
+        counts[k++] = n;
+        ptrs[k] = &u->rolling_mean;
+        counts[k++] = n;
+        ptrs[k] = &u->rolling_variance;
+        counts[k++] = n;
+    }
+    if(u->type == CONVOLUTIONAL || u->type == DECONVOLUTIONAL || u->type == LOCAL){
+        ptrs[k] = &u->weights;
+        counts[k++] = num;
+    }
+    return k;
+}
+
+/* the classic weights file is read one layer per fread on the calling thread
+ * while a pool of threads copies the staged bytes into the layers and does
+ * the per layer transposes, so io overlaps the unpacking. device pushes stay
+ * on the calling thread since it owns the cuda context */
+
+typedef struct{
+    layer *unit;
+    char *buf;
+    size_t size;
+    int transpose;
+} weights_job;
+
+typedef struct{
+    queue *jobs;
+    double busy;
+} weights_worker;
+
+static void unpack_weight_unit(weights_job *job)
+{
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    layer *u = job->unit;
+    int k;
+    size_t offset = 0;
+    int nt = stored_unit_tensors(u, ptrs, counts);
+    for(k = 0; k < nt && offset < job->size; ++k){
+        size_t bytes = counts[k]*sizeof(float);
+        if(bytes > job->size - offset) bytes = job->size - offset;
+        memcpy(*ptrs[k], job->buf + offset, bytes);
+        offset += bytes;
+    }
+    if(u->type == CONNECTED && job->transpose){
+        transpose_matrix(u->weights, u->inputs, u->outputs);
+    }
+    if((u->type == CONVOLUTIONAL || u->type == DECONVOLUTIONAL) && u->flipped){
+        transpose_matrix(u->weights, u->c*u->size*u->size, u->numload ? u->numload : u->n);
+    }
+}
+
+static void *weights_worker_thread(void *ptr)
+{
+    weights_worker *w = (weights_worker *)ptr;
+    while(1){
+        weights_job *job = queue_pop(w->jobs);
+        if(!job) break;
+        double start = what_time_is_it_now();
+        unpack_weight_unit(job);
+        w->busy += what_time_is_it_now() - start;
+        free(job->buf);
+        free(job);
+    }
+    return 0;
+}
+
+static int weights_threads()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1) n = 1;
+    if(n > 8) n = 8;
+    return n;
+}
+
 void load_weights_upto(network *net, char *filename, int start, int cutoff)
 {
 #ifdef GPU
@@ -1279,6 +2164,10 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
         cuda_set_device(net->gpu_index);
     }
 #endif
+    if(is_mapped_weights(filename)){
+        load_weights_mapped(net, filename, start, cutoff);
+        return;
+    }
     fprintf(stderr, "Loading weights from %s...", filename);
     fflush(stdout);
     FILE *fp = fopen(filename, "rb");
@@ -1299,66 +2188,64 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
     }
     int transpose = (major > 1000) || (minor > 1000);
 
-    int i;
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_UNIT_TENSORS];
+    int counts[MAX_UNIT_TENSORS];
+    int i, u, k;
+    int nthreads = weights_threads();
+    double io = 0;
+    double begin = what_time_is_it_now();
+    weights_worker *workers = calloc(nthreads, sizeof(weights_worker));
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    queue *jobs = make_queue(2*nthreads);
+    for(i = 0; i < nthreads; ++i){
+        workers[i].jobs = jobs;
+        if(pthread_create(threads + i, 0, weights_worker_thread, workers + i)) error("Thread creation failed");
+    }
     for(i = start; i < net->n && i < cutoff; ++i){
-        layer l = net->layers[i];
-        if (l.dontload) continue;
-        if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
-            load_convolutional_weights(l, fp);
-        }
-        if(l.type == CONNECTED){
-            load_connected_weights(l, fp, transpose);
+        layer *l = net->layers + i;
+        if (l->dontload) continue;
+        if(l->skipped){
+            fseek(fp, l->skipped_bytes, SEEK_CUR);
+            continue;
         }
-        if(l.type == BATCHNORM){
-            load_batchnorm_weights(l, fp);
+        int nu = weight_units(l, units);
+        for(u = 0; u < nu; ++u){
+            size_t size = 0;
+            int nt = stored_unit_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k) size += counts[k]*sizeof(float);
+            weights_job *job = calloc(1, sizeof(weights_job));
+            job->unit = units[u];
+            job->transpose = transpose;
+            job->buf = malloc(size);
+            double t = what_time_is_it_now();
+            job->size = fread(job->buf, 1, size, fp);
+            io += what_time_is_it_now() - t;
+            queue_push(jobs, job);
         }
-        if(l.type == CRNN){
-            load_convolutional_weights(*(l.input_layer), fp);
-            load_convolutional_weights(*(l.self_layer), fp);
-            load_convolutional_weights(*(l.output_layer), fp);
-        }
-        if(l.type == RNN){
-            load_connected_weights(*(l.input_layer), fp, transpose);
-            load_connected_weights(*(l.self_layer), fp, transpose);
-            load_connected_weights(*(l.output_layer), fp, transpose);
-        }
-        if (l.type == LSTM) {
-            load_connected_weights(*(l.wi), fp, transpose);
-            load_connected_weights(*(l.wf), fp, transpose);
-            load_connected_weights(*(l.wo), fp, transpose);
-            load_connected_weights(*(l.wg), fp, transpose);
-            load_connected_weights(*(l.ui), fp, transpose);
-            load_connected_weights(*(l.uf), fp, transpose);
-            load_connected_weights(*(l.uo), fp, transpose);
-            load_connected_weights(*(l.ug), fp, transpose);
-        }
-        if (l.type == GRU) {
-            if(1){
-                load_connected_weights(*(l.wz), fp, transpose);
-                load_connected_weights(*(l.wr), fp, transpose);
-                load_connected_weights(*(l.wh), fp, transpose);
-                load_connected_weights(*(l.uz), fp, transpose);
-                load_connected_weights(*(l.ur), fp, transpose);
-                load_connected_weights(*(l.uh), fp, transpose);
-            }else{
-                load_connected_weights(*(l.reset_layer), fp, transpose);
-                load_connected_weights(*(l.update_layer), fp, transpose);
-                load_connected_weights(*(l.state_layer), fp, transpose);
-            }
-        }
-        if(l.type == LOCAL){
-            int locations = l.out_w*l.out_h;
-            int size = l.size*l.size*l.c*l.n*locations;
-            fread(l.biases, sizeof(float), l.outputs, fp);
-            fread(l.weights, sizeof(float), size, fp);
+    }
+    for(i = 0; i < nthreads; ++i) queue_push(jobs, 0);
+    double unpack = 0;
+    for(i = 0; i < nthreads; ++i){
+        pthread_join(threads[i], 0);
+        unpack += workers[i].busy;
+    }
+    double unpacked = what_time_is_it_now();
+    free_queue(jobs);
+    free(threads);
+    free(workers);
 #ifdef GPU
-            if(gpu_index >= 0){
-                push_local_layer(l);
-            }
-#endif
+    if(gpu_index >= 0){
+        for(i = start; i < net->n && i < cutoff; ++i){
+            if (net->layers[i].dontload) continue;
+            if (net->layers[i].skipped) continue;
+            int nu = weight_units(net->layers + i, units);
+            for(u = 0; u < nu; ++u) push_weight_unit(units[u]);
         }
     }
-    fprintf(stderr, "Done!\n");
+#endif
+    double end = what_time_is_it_now();
+    fprintf(stderr, "Done! read %.3fs, unpack %.3fs on %d threads, push %.3fs, total %.3fs\n", io, unpack, nthreads, end - unpacked, end - begin);
     fclose(fp);
 }
 
@@ -1367,3 +2254,117 @@ void load_weights(network *net, char *filename)
     load_weights_upto(net, filename, 0, net->n);
 }
 
+
+/* the optimizer state of a network is the momentum its layers carry in the
+ * *_updates buffers and, with adam, the moment estimates. checkpoints keep
+ * it in <weights>.state so training resumes exactly where it stopped rather
+ * than with the momentum zeroed */
+
+#define OPTIMIZER_STATE_MAGIC "DNOPT001"
+#define MAX_OPTIMIZER_TENSORS 9
+
+typedef struct{
+    char magic[8];
+    int t;
+    int pad;
+    size_t floats;
+} optimizer_state_header;
+
+static int optimizer_tensors(layer *u, float ***ptrs, int *counts)
+{
+    int k = unit_updates(u, ptrs, counts);
+    if(!u->m || u->type == BATCHNORM) return k;
+    int nb = counts[0];
+    int nw = counts[1];
+    ptrs[k] = &u->bias_m;
+    counts[k++] = nb;
+    ptrs[k] = &u->bias_v;
+    counts[k++] = nb;
+    ptrs[k] = &u->m;
+    counts[k++] = nw;
+    ptrs[k] = &u->v;
+    counts[k++] = nw;
+    if(u->batch_normalize && u->scale_m){
+        ptrs[k] = &u->scale_m;
+        counts[k++] = nb;
+        ptrs[k] = &u->scale_v;
+        counts[k++] = nb;
+    }
+    return k;
+}
+
+static size_t optimizer_state_floats(network *net)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_OPTIMIZER_TENSORS];
+    int counts[MAX_OPTIMIZER_TENSORS];
+    int i, u, k;
+    size_t n = 0;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].skipped) continue;
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = optimizer_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k) n += counts[k];
+        }
+    }
+    return n;
+}
+
+/* on the gpu the state is whatever the last write_weights_upto pulled */
+void write_optimizer_state(network *net, FILE *fp)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_OPTIMIZER_TENSORS];
+    int counts[MAX_OPTIMIZER_TENSORS];
+    int i, u, k;
+    optimizer_state_header header = {{0}};
+    memcpy(header.magic, OPTIMIZER_STATE_MAGIC, sizeof(header.magic));
+    header.t = *net->t;
+    header.floats = optimizer_state_floats(net);
+    fwrite(&header, sizeof(header), 1, fp);
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].skipped) continue;
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = optimizer_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k) fwrite(*ptrs[k], sizeof(float), counts[k], fp);
+        }
+    }
+}
+
+/* reads <weightfile>.state if there is one, returns whether there was */
+int load_optimizer_state(network *net, char *weightfile)
+{
+    layer *units[MAX_WEIGHT_UNITS];
+    float **ptrs[MAX_OPTIMIZER_TENSORS];
+    int counts[MAX_OPTIMIZER_TENSORS];
+    int i, u, k;
+    optimizer_state_header header;
+    char *buff = calloc(strlen(weightfile) + 7, 1);
+    sprintf(buff, "%s.state", weightfile);
+    FILE *fp = fopen(buff, "rb");
+    if(fp) fprintf(stderr, "Loading optimizer state from %s\n", buff);
+    free(buff);
+    if(!fp) return 0;
+    if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, OPTIMIZER_STATE_MAGIC, sizeof(header.magic))
+            || header.floats != optimizer_state_floats(net)){
+        error("Optimizer state does not match the network");
+    }
+    *net->t = header.t;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].skipped) continue;
+        int nu = weight_units(net->layers + i, units);
+        for(u = 0; u < nu; ++u){
+            int nt = optimizer_tensors(units[u], ptrs, counts);
+            for(k = 0; k < nt; ++k){
+                if(fread(*ptrs[k], sizeof(float), counts[k], fp) != counts[k]) error("Optimizer state is truncated");
+            }
+#ifdef GPU
+            if(gpu_index >= 0) push_weight_unit(units[u]);
+#endif
+        }
+    }
+    fclose(fp);
+    return 1;
+}
@@ -3,7 +3,17 @@
 #include "darknet.h"
 #include "network.h"
 
+#define MAX_WEIGHT_UNITS 8
+#define MAX_UNIT_TENSORS 5
+
 void save_network(network net, char *filename);
 void save_weights_double(network net, char *filename);
+int is_mapped_weights(char *filename);
+void unmap_weights(network *net);
+int weight_units(layer *l, layer **units);
+int unit_tensors(layer *u, float ***ptrs, int *counts);
+int unit_updates(layer *u, float ***ptrs, int *counts);
+void write_weights_upto(network *net, FILE *fp, int cutoff);
+void write_optimizer_state(network *net, FILE *fp);
 
 #endif
@@ -0,0 +1,96 @@
+#include "queue.h"
+#include <sched.h>
+#include <time.h>
+
+queue *make_queue(int size)
+{
+    size_t i;
+    size_t n = 2;
+    while(n < size) n <<= 1;
+    queue *q = calloc(1, sizeof(queue));
+    q->mask = n - 1;
+    q->cells = calloc(n, sizeof(queue_cell));
+    for(i = 0; i < n; ++i){
+        q->cells[i].seq = i;
+    }
+    return q;
+}
+
+void free_queue(queue *q)
+{
+    free(q->cells);
+    free(q);
+}
+
+int queue_try_push(queue *q, void *val)
+{
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    while(1){
+        queue_cell *c = q->cells + (pos & q->mask);
+        size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)pos;
+        if(diff == 0){
+            if(__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                c->val = val;
+                __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if(diff < 0){
+            return 0;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+int queue_try_pop(queue *q, void **val)
+{
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    while(1){
+        queue_cell *c = q->cells + (pos & q->mask);
+        size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)(pos + 1);
+        if(diff == 0){
+            if(__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                *val = c->val;
+                __atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if(diff < 0){
+            return 0;
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void queue_backoff(int *spins)
+{
+    if(++*spins < 64){
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 100000};
+        nanosleep(&ts, 0);
+    }
+}
+
+void queue_push(queue *q, void *val)
+{
+    int spins = 0;
+    while(!queue_try_push(q, val)) queue_backoff(&spins);
+}
+
+void *queue_pop(queue *q)
+{
+    int spins = 0;
+    void *val = 0;
+    while(!queue_try_pop(q, &val)) queue_backoff(&spins);
+    return val;
+}
+
+int queue_count(queue *q)
+{
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+}
@@ -0,0 +1,31 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+#include "darknet.h"
+
+typedef struct{
+    size_t seq;
+    void *val;
+} queue_cell;
+
+/* bounded lock-free multi-producer multi-consumer ring. head and tail sit on
+ * their own cache lines so producers and consumers don't false share */
+typedef struct{
+    size_t mask;
+    queue_cell *cells;
+    char pad0[64];
+    size_t head;
+    char pad1[64];
+    size_t tail;
+    char pad2[64];
+} queue;
+
+queue *make_queue(int size);
+void free_queue(queue *q);
+int queue_try_push(queue *q, void *val);
+int queue_try_pop(queue *q, void **val);
+void queue_push(queue *q, void *val);
+void *queue_pop(queue *q);
+int queue_count(queue *q);
+void queue_backoff(int *spins);
+
+#endif
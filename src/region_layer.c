@@ -3,6 +3,7 @@
 #include "blas.h"
 #include "box.h"
 #include "cuda.h"
+#include "tree.h"
 #include "utils.h"
 
 #include <stdio.h>
@@ -172,11 +173,15 @@ void forward_region_layer(const layer l, network net)
         }
     }
     if (l.softmax_tree){
-        int i;
-        int count = l.coords + 1;
+        /* a group is a run of class planes, softmax it for every cell of an
+         * anchor in one sweep over the planes */
+        int count = 0;
         for (i = 0; i < l.softmax_tree->groups; ++i) {
             int group_size = l.softmax_tree->group_size[i];
-            softmax_cpu(net.input + count, group_size, l.batch, l.inputs, l.n*l.w*l.h, 1, l.n*l.w*l.h, l.temperature, l.output + count);
+            for(b = 0; b < l.batch*l.n; ++b){
+                int index = b*l.inputs/l.n + (l.coords + 1 + count)*l.w*l.h;
+                softmax_planes_cpu(net.input + index, group_size, l.w*l.h, l.w*l.h, l.temperature, l.output + index);
+            }
             count += group_size;
         }
     } else if (l.softmax){
@@ -361,10 +366,13 @@ void correct_region_boxes(detection *dets, int n, int w, int h, int netw, int ne
     }
 }
 
-void get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection *dets)
+/* averages in the flipped image and walks the class tree, once per call.
+ * returns the top class of every cell when the tree is walked without a map */
+static int *prepare_region_detections(layer l, int *map, float tree_thresh)
 {
     int i,j,n,z;
     float *predictions = l.output;
+    int *top = (l.softmax_tree && !map) ? calloc(l.w*l.h*l.n, sizeof(int)) : 0;
     if (l.batch == 2) {
         float *flip = l.output + l.outputs;
         for (j = 0; j < l.h; ++j) {
@@ -388,54 +396,93 @@ void get_region_detections(layer l, int w, int h, int netw, int neth, float thre
             l.output[i] = (l.output[i] + flip[i])/2.;
         }
     }
-    for (i = 0; i < l.w*l.h; ++i){
-        int row = i / l.w;
-        int col = i % l.w;
+    if(l.softmax_tree){
+        /* walk the tree for all cells of an anchor together, plane by plane */
         for(n = 0; n < l.n; ++n){
-            int index = n*l.w*l.h + i;
-            for(j = 0; j < l.classes; ++j){
-                dets[index].prob[j] = 0;
-            }
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, l.coords);
-            int box_index  = entry_index(l, 0, n*l.w*l.h + i, 0);
-            int mask_index = entry_index(l, 0, n*l.w*l.h + i, 4);
-            float scale = l.background ? 1 : predictions[obj_index];
-            dets[index].bbox = get_region_box(predictions, l.biases, n, box_index, col, row, l.w, l.h, l.w*l.h);
-            dets[index].objectness = scale > thresh ? scale : 0;
-            if(dets[index].mask){
-                for(j = 0; j < l.coords - 4; ++j){
-                    dets[index].mask[j] = l.output[mask_index + j*l.w*l.h];
-                }
-            }
+            int class_index = entry_index(l, 0, n*l.w*l.h, l.coords + !l.background);
+            hierarchy_predictions_planes(predictions + class_index, l.classes, l.softmax_tree, 0, l.w*l.h, l.w*l.h);
+            if(top) hierarchy_top_predictions(predictions + class_index, l.softmax_tree, tree_thresh, l.w*l.h, l.w*l.h, top + n*l.w*l.h);
+        }
+    }
+    return top;
+}
 
-            int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + !l.background);
-            if(l.softmax_tree){
+static void decode_region_detection(layer l, int n, int i, float thresh, int *map, int *top, detection *det)
+{
+    int j;
+    float *predictions = l.output;
+    int index = n*l.w*l.h + i;
+    for(j = 0; j < l.classes; ++j){
+        det->prob[j] = 0;
+    }
+    int obj_index  = entry_index(l, 0, n*l.w*l.h + i, l.coords);
+    int box_index  = entry_index(l, 0, n*l.w*l.h + i, 0);
+    int mask_index = entry_index(l, 0, n*l.w*l.h + i, 4);
+    float scale = l.background ? 1 : predictions[obj_index];
+    det->bbox = get_region_box(predictions, l.biases, n, box_index, i % l.w, i / l.w, l.w, l.h, l.w*l.h);
+    det->objectness = scale > thresh ? scale : 0;
+    det->classes = l.classes;
+    if(det->mask){
+        for(j = 0; j < l.coords - 4; ++j){
+            det->mask[j] = l.output[mask_index + j*l.w*l.h];
+        }
+    }
 
-                hierarchy_predictions(predictions + class_index, l.classes, l.softmax_tree, 0, l.w*l.h);
-                if(map){
-                    for(j = 0; j < 200; ++j){
-                        int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1 + map[j]);
-                        float prob = scale*predictions[class_index];
-                        dets[index].prob[j] = (prob > thresh) ? prob : 0;
-                    }
-                } else {
-                    int j =  hierarchy_top_prediction(predictions + class_index, l.softmax_tree, tree_thresh, l.w*l.h);
-                    dets[index].prob[j] = (scale > thresh) ? scale : 0;
-                }
-            } else {
-                if(dets[index].objectness){
-                    for(j = 0; j < l.classes; ++j){
-                        int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1 + j);
-                        float prob = scale*predictions[class_index];
-                        dets[index].prob[j] = (prob > thresh) ? prob : 0;
-                    }
-                }
+    if(l.softmax_tree){
+        if(map){
+            for(j = 0; j < 200; ++j){
+                int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1 + map[j]);
+                float prob = scale*predictions[class_index];
+                det->prob[j] = (prob > thresh) ? prob : 0;
             }
+        } else {
+            det->prob[top[index]] = (scale > thresh) ? scale : 0;
+        }
+    } else {
+        if(det->objectness){
+            for(j = 0; j < l.classes; ++j){
+                int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1 + j);
+                float prob = scale*predictions[class_index];
+                det->prob[j] = (prob > thresh) ? prob : 0;
+            }
+        }
+    }
+}
+
+void get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection *dets)
+{
+    int i,n;
+    int *top = prepare_region_detections(l, map, tree_thresh);
+    for (i = 0; i < l.w*l.h; ++i){
+        for(n = 0; n < l.n; ++n){
+            decode_region_detection(l, n, i, thresh, map, top, dets + n*l.w*l.h + i);
         }
     }
+    free(top);
     correct_region_boxes(dets, l.w*l.h*l.n, w, h, netw, neth, relative);
 }
 
+/* hands over the cells above thresh one at a time, decoded into a single
+ * detection, so no buffer for the whole grid is ever made */
+void stream_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection_handler handler, void *ctx)
+{
+    int i,n;
+    float *predictions = l.output;
+    detection *det = make_detections(1, l.classes, l.coords);
+    int *top = prepare_region_detections(l, map, tree_thresh);
+    for(n = 0; n < l.n; ++n){
+        for(i = 0; i < l.w*l.h; ++i){
+            if(!l.background && !(predictions[entry_index(l, 0, n*l.w*l.h + i, l.coords)] > thresh)) continue;
+            decode_region_detection(l, n, i, thresh, map, top, det);
+            if(!det->objectness) continue;
+            correct_region_boxes(det, 1, w, h, netw, neth, relative);
+            handler(det, ctx);
+        }
+    }
+    free(top);
+    free_detections(det, 1);
+}
+
 #ifdef GPU
 
 void forward_region_layer_gpu(const layer l, network net)
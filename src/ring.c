@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include "ring.h"
+#include "utils.h"
+#include "blas.h"
+
+/* ring all-reduce between the processes of one training job. rank i reads
+ * from rank i-1 and writes to rank i+1, an all-reduce is a reduce-scatter
+ * followed by an all-gather so every link carries 2(n-1)/n of the data no
+ * matter how many ranks there are. the gradients of the last subdivision
+ * are handed over layer by layer as backward produces them and reduced in
+ * buckets on a communication thread while backward goes on with the layers
+ * below */
+
+#define RING_SEGMENT 8192
+#define RING_BUCKET (1<<20)
+#define RING_SOCKET_BUFFER (1<<19)
+#define RING_CONNECT_TRIES 600
+
+static void socket_send(ring_link *l, void *buf, size_t size)
+{
+    char *p = buf;
+    while(size){
+        ssize_t k = send(l->fd, p, size, MSG_NOSIGNAL);
+        if(k < 0 && errno == EINTR) continue;
+        if(k <= 0) error("Ring connection lost");
+        p += k;
+        size -= k;
+    }
+}
+
+static void socket_recv(ring_link *l, void *buf, size_t size)
+{
+    char *p = buf;
+    while(size){
+        ssize_t k = recv(l->fd, p, size, 0);
+        if(k < 0 && errno == EINTR) continue;
+        if(k <= 0) error("Ring connection lost");
+        p += k;
+        size -= k;
+    }
+}
+
+static void socket_close(ring_link *l)
+{
+    close(l->fd);
+    free(l);
+}
+
+/* the ring keeps at most two segments in flight per link, the buffers are
+ * sized so a send never waits on a neighbour that is itself sending */
+static ring_link *socket_link(int fd)
+{
+    int size = RING_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    ring_link *l = calloc(1, sizeof(ring_link));
+    l->fd = fd;
+    l->send = socket_send;
+    l->recv = socket_recv;
+    l->close = socket_close;
+    return l;
+}
+
+static ring_link *socket_accept(int fd)
+{
+    int c = accept(fd, 0, 0);
+    if(c < 0) error("Ring accept failed");
+    return socket_link(c);
+}
+
+static void ring_wait()
+{
+    struct timespec ts = {0, 100000000};
+    nanosleep(&ts, 0);
+}
+
+static void split_host(char *addr, char *host, char *port)
+{
+    char *colon = strrchr(addr, ':');
+    if(!colon || colon - addr > 255 || strlen(colon+1) > 15) error("Ring tcp address must be host:port");
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = 0;
+    strcpy(port, colon+1);
+}
+
+static int tcp_listen(char *addr)
+{
+    char host[256], port[16];
+    split_host(addr, host, port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = {0};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(atoi(port));
+    if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, 1)) error("Ring listen failed");
+    return fd;
+}
+
+static ring_link *tcp_accept(int fd)
+{
+    ring_link *l = socket_accept(fd);
+    int one = 1;
+    setsockopt(l->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return l;
+}
+
+static ring_link *tcp_connect(char *addr)
+{
+    char host[256], port[16];
+    struct addrinfo hints = {0}, *res;
+    int i;
+    split_host(addr, host, port);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    for(i = 0; i < RING_CONNECT_TRIES; ++i){
+        if(!getaddrinfo(host, port, &hints, &res)){
+            int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+            int ok = !connect(fd, res->ai_addr, res->ai_addrlen);
+            freeaddrinfo(res);
+            if(ok){
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                return socket_link(fd);
+            }
+            close(fd);
+        }
+        ring_wait();
+    }
+    error("Ring could not reach its neighbour");
+    return 0;
+}
+
+static void unix_address(char *path, struct sockaddr_un *sa)
+{
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(sa->sun_path)) error("Ring socket path too long");
+    strcpy(sa->sun_path, path);
+}
+
+static int unix_listen(char *addr)
+{
+    struct sockaddr_un sa;
+    unix_address(addr, &sa);
+    unlink(addr);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, 1)) error("Ring listen failed");
+    return fd;
+}
+
+static ring_link *unix_connect(char *addr)
+{
+    struct sockaddr_un sa;
+    int i;
+    unix_address(addr, &sa);
+    for(i = 0; i < RING_CONNECT_TRIES; ++i){
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(!connect(fd, (struct sockaddr *)&sa, sizeof(sa))) return socket_link(fd);
+        close(fd);
+        ring_wait();
+    }
+    error("Ring could not reach its neighbour");
+    return 0;
+}
+
+transport tcp_transport = {"tcp", tcp_listen, tcp_accept, tcp_connect};
+transport unix_transport = {"unix", unix_listen, socket_accept, unix_connect};
+
+static transport *transports[] = {&tcp_transport, &unix_transport};
+
+/* tcp:host:port gives rank i port+i on host, tcp:h0:p0,h1:p1,... names
+ * every rank, unix:path gives rank i the socket path.i */
+static char *ring_address(transport *t, char *spec, int rank)
+{
+    char *addr = calloc(strlen(spec) + 32, sizeof(char));
+    if(t == &unix_transport){
+        sprintf(addr, "%s.%d", spec, rank);
+    } else if(strchr(spec, ',')){
+        int i;
+        char *p = spec;
+        for(i = 0; i < rank && p; ++i){
+            p = strchr(p, ',');
+            if(p) ++p;
+        }
+        if(!p) error("Ring has fewer addresses than ranks");
+        char *end = strchr(p, ',');
+        int len = end ? end - p : strlen(p);
+        memcpy(addr, p, len);
+    } else {
+        char host[256], port[16];
+        split_host(spec, host, port);
+        sprintf(addr, "%s:%d", host, atoi(port) + rank);
+    }
+    return addr;
+}
+
+static void ring_exchange(ring *r, float *out, int nout, float *in, int nin, int add)
+{
+    int sent = 0;
+    int got = 0;
+    while(sent < nout || got < nin){
+        if(sent < nout){
+            int k = nout - sent < RING_SEGMENT ? nout - sent : RING_SEGMENT;
+            r->next->send(r->next, out + sent, k*sizeof(float));
+            sent += k;
+        }
+        if(got < nin){
+            int k = nin - got < RING_SEGMENT ? nin - got : RING_SEGMENT;
+            if(add){
+                r->prev->recv(r->prev, r->tmp, k*sizeof(float));
+                axpy_cpu(k, 1, r->tmp, 1, in + got, 1);
+            } else {
+                r->prev->recv(r->prev, in + got, k*sizeof(float));
+            }
+            got += k;
+        }
+    }
+}
+
+static int chunk_start(int n, int p, int c)
+{
+    return (int)((long)n*c/p);
+}
+
+void ring_allreduce(ring *r, float *x, int n)
+{
+    int p = r->size;
+    int s;
+    if(p < 2) return;
+    for(s = 0; s < p-1; ++s){
+        int sc = (r->rank - s + p)%p;
+        int rc = (r->rank - s - 1 + p)%p;
+        ring_exchange(r, x + chunk_start(n, p, sc), chunk_start(n, p, sc+1) - chunk_start(n, p, sc),
+                x + chunk_start(n, p, rc), chunk_start(n, p, rc+1) - chunk_start(n, p, rc), 1);
+    }
+    for(s = 0; s < p-1; ++s){
+        int sc = (r->rank - s + 1 + p)%p;
+        int rc = (r->rank - s + p)%p;
+        ring_exchange(r, x + chunk_start(n, p, sc), chunk_start(n, p, sc+1) - chunk_start(n, p, sc),
+                x + chunk_start(n, p, rc), chunk_start(n, p, rc+1) - chunk_start(n, p, rc), 0);
+    }
+}
+
+/* rank 0's bytes travel once around the ring, a segment at a time */
+void ring_broadcast(ring *r, void *x, size_t size)
+{
+    char *p = x;
+    size_t off;
+    if(r->size < 2) return;
+    for(off = 0; off < size; off += RING_SEGMENT*sizeof(float)){
+        size_t k = size - off < RING_SEGMENT*sizeof(float) ? size - off : RING_SEGMENT*sizeof(float);
+        if(r->rank) r->prev->recv(r->prev, p + off, k);
+        if(r->rank != r->size - 1) r->next->send(r->next, p + off, k);
+    }
+}
+
+static void reduce_bucket(ring *r, ring_bucket *b)
+{
+    int i;
+    if(b->nspans == 1){
+        ring_allreduce(r, b->spans[0].x, b->spans[0].n);
+        return;
+    }
+    if(b->size > r->buf_size){
+        free(r->buf);
+        r->buf = calloc(b->size, sizeof(float));
+        r->buf_size = b->size;
+    }
+    float *p = r->buf;
+    for(i = 0; i < b->nspans; ++i){
+        memcpy(p, b->spans[i].x, b->spans[i].n*sizeof(float));
+        p += b->spans[i].n;
+    }
+    ring_allreduce(r, r->buf, b->size);
+    p = r->buf;
+    for(i = 0; i < b->nspans; ++i){
+        memcpy(b->spans[i].x, p, b->spans[i].n*sizeof(float));
+        p += b->spans[i].n;
+    }
+}
+
+static void *ring_thread(void *ptr)
+{
+    ring *r = (ring *)ptr;
+    while(1){
+        ring_bucket *b = queue_pop(r->jobs);
+        if(!b) break;
+        reduce_bucket(r, b);
+        free(b->spans);
+        free(b);
+        __atomic_sub_fetch(&r->pending, 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void submit_bucket(ring *r)
+{
+    __atomic_add_fetch(&r->pending, 1, __ATOMIC_RELAXED);
+    queue_push(r->jobs, r->open);
+    r->open = 0;
+}
+
+/* queues x for reduction, the buckets fill up in the same order on every
+ * rank so they match without any negotiation */
+void ring_push(ring *r, float *x, int n)
+{
+    if(r->size < 2 || n <= 0) return;
+    if(!r->open) r->open = calloc(1, sizeof(ring_bucket));
+    ring_bucket *b = r->open;
+    b->spans = realloc(b->spans, (b->nspans + 1)*sizeof(ring_span));
+    b->spans[b->nspans].x = x;
+    b->spans[b->nspans].n = n;
+    ++b->nspans;
+    b->size += n;
+    if(b->size >= r->bucket) submit_bucket(r);
+}
+
+/* waits until everything pushed so far is reduced on every rank */
+void ring_flush(ring *r)
+{
+    int spins = 0;
+    if(r->open) submit_bucket(r);
+    while(__atomic_load_n(&r->pending, __ATOMIC_ACQUIRE)) queue_backoff(&spins);
+    r->armed = 0;
+}
+
+ring *make_ring(char *spec, int rank, int size)
+{
+    int i;
+    ring *r = calloc(1, sizeof(ring));
+    r->rank = rank;
+    r->size = size;
+    r->bucket = RING_BUCKET;
+    if(rank < 0 || rank >= size) error("Ring rank out of range");
+    if(size < 2) return r;
+
+    transport *t = 0;
+    char *colon = strchr(spec, ':');
+    for(i = 0; colon && i < sizeof(transports)/sizeof(transports[0]); ++i){
+        if(strlen(transports[i]->scheme) == colon - spec && !strncmp(spec, transports[i]->scheme, colon - spec)) t = transports[i];
+    }
+    if(!t) error("Unknown ring transport, use tcp:host:port or unix:path");
+
+    char *mine = ring_address(t, colon+1, rank);
+    char *next = ring_address(t, colon+1, (rank+1)%size);
+    int fd = t->listen(mine);
+    r->next = t->connect(next);
+    r->next->send(r->next, &rank, sizeof(int));
+    r->prev = t->accept(fd);
+    int prev = -1;
+    r->prev->recv(r->prev, &prev, sizeof(int));
+    if(prev != (rank + size - 1)%size) error("Ring neighbours disagree");
+    close(fd);
+    if(t == &unix_transport) unlink(mine);
+    fprintf(stderr, "Ring rank %d of %d: %s -> %s\n", rank, size, mine, next);
+    free(mine);
+    free(next);
+
+    r->tmp = calloc(RING_SEGMENT, sizeof(float));
+    r->jobs = make_queue(256);
+    if(pthread_create(&r->thread, 0, ring_thread, r)) error("Thread creation failed");
+    return r;
+}
+
+void free_ring(ring *r)
+{
+    if(r->size > 1){
+        ring_flush(r);
+        queue_push(r->jobs, 0);
+        pthread_join(r->thread, 0);
+        free_queue(r->jobs);
+        r->next->close(r->next);
+        r->prev->close(r->prev);
+    }
+    free(r->buf);
+    free(r->tmp);
+    free(r);
+}
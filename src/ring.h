@@ -0,0 +1,62 @@
+#ifndef RING_H
+#define RING_H
+#include "darknet.h"
+#include "queue.h"
+
+typedef struct ring_link ring_link;
+
+/* a reliable ordered byte stream to one neighbour, send and recv move the
+ * whole buffer or die */
+struct ring_link{
+    int fd;
+    void (*send)(ring_link *l, void *buf, size_t size);
+    void (*recv)(ring_link *l, void *buf, size_t size);
+    void (*close)(ring_link *l);
+};
+
+/* how ranks reach each other. listen binds the address of this rank, accept
+ * takes the next dial on it and connect dials a neighbour, retrying until it
+ * is up */
+typedef struct{
+    char *scheme;
+    int (*listen)(char *addr);
+    ring_link *(*accept)(int fd);
+    ring_link *(*connect)(char *addr);
+} transport;
+
+typedef struct{
+    float *x;
+    int n;
+} ring_span;
+
+typedef struct{
+    ring_span *spans;
+    int nspans;
+    int size;
+} ring_bucket;
+
+struct ring{
+    int rank;
+    int size;
+    ring_link *next;
+    ring_link *prev;
+    int armed;
+    int bucket;
+    ring_bucket *open;
+    int pending;
+    queue *jobs;
+    pthread_t thread;
+    float *buf;
+    int buf_size;
+    float *tmp;
+};
+
+extern transport tcp_transport;
+extern transport unix_transport;
+
+void ring_allreduce(ring *r, float *x, int n);
+void ring_broadcast(ring *r, void *x, size_t size);
+void ring_push(ring *r, float *x, int n);
+void ring_flush(ring *r);
+
+#endif
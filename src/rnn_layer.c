@@ -36,22 +36,22 @@ layer make_rnn_layer(int batch, int inputs, int outputs, int steps, ACTIVATION a
     l.steps = steps;
     l.inputs = inputs;
 
-    l.state = calloc(batch*outputs, sizeof(float));
+    l.state = calloc(batch*outputs*(steps+1), sizeof(float));
     l.prev_state = calloc(batch*outputs, sizeof(float));
 
     l.input_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.input_layer) = make_connected_layer(batch*steps, inputs, outputs, activation, batch_normalize, adam);
+    *(l.input_layer) = make_connected_layer(batch*steps, inputs, outputs, activation, batch_normalize, adam, 1);
     l.input_layer->batch = batch;
 
     l.self_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.self_layer) = make_connected_layer(batch*steps, outputs, outputs, activation, batch_normalize, adam);
+    *(l.self_layer) = make_connected_layer(batch*steps, outputs, outputs, activation, batch_normalize, adam, 1);
     l.self_layer->batch = batch;
 
     l.output_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.output_layer) = make_connected_layer(batch*steps, outputs, outputs, activation, batch_normalize, adam);
+    *(l.output_layer) = make_connected_layer(batch*steps, outputs, outputs, activation, batch_normalize, adam, 1);
     l.output_layer->batch = batch;
 
     l.outputs = outputs;
@@ -86,11 +86,19 @@ void update_rnn_layer(layer l, update_args a)
     update_connected_layer(*(l.output_layer), a);
 }
 
+/* the input projections of all steps in one gemm, the rows are independent
+ * unless batchnorm is still collecting statistics */
+static void forward_all_steps(layer l, network s, int steps)
+{
+    l.batch *= steps;
+    forward_connected_layer(l, s);
+}
+
 void forward_rnn_layer(layer l, network net)
 {
     network s = net;
     s.train = net.train;
-    int i;
+    int i, k;
     layer input_layer = *(l.input_layer);
     layer self_layer = *(l.self_layer);
     layer output_layer = *(l.output_layer);
@@ -100,30 +108,45 @@ void forward_rnn_layer(layer l, network net)
     fill_cpu(l.outputs * l.batch * l.steps, 0, input_layer.delta, 1);
     if(net.train) fill_cpu(l.outputs * l.batch, 0, l.state, 1);
 
-    for (i = 0; i < l.steps; ++i) {
+    float *states = l.state;
+    int hoist = !(l.batch_normalize && net.train);
+    if(hoist){
         s.input = net.input;
-        forward_connected_layer(input_layer, s);
+        forward_all_steps(input_layer, s, l.steps);
+    }
+
+    for (i = 0; i < l.steps; ++i) {
+        if(!hoist){
+            s.input = net.input;
+            forward_connected_layer(input_layer, s);
+        }
 
         s.input = l.state;
         forward_connected_layer(self_layer, s);
 
         float *old_state = l.state;
         if(net.train) l.state += l.outputs*l.batch;
-        if(l.shortcut){
-            copy_cpu(l.outputs * l.batch, old_state, 1, l.state, 1);
-        }else{
-            fill_cpu(l.outputs * l.batch, 0, l.state, 1);
+        for(k = 0; k < l.outputs*l.batch; ++k){
+            float prev = l.shortcut ? old_state[k] : 0;
+            l.state[k] = prev + input_layer.output[k] + self_layer.output[k];
         }
-        axpy_cpu(l.outputs * l.batch, 1, input_layer.output, 1, l.state, 1);
-        axpy_cpu(l.outputs * l.batch, 1, self_layer.output, 1, l.state, 1);
 
-        s.input = l.state;
-        forward_connected_layer(output_layer, s);
+        if(!hoist || !net.train){
+            s.input = l.state;
+            forward_connected_layer(output_layer, s);
+        }
 
         net.input += l.inputs*l.batch;
         increment_layer(&input_layer, 1);
         increment_layer(&self_layer, 1);
-        increment_layer(&output_layer, 1);
+        if(!hoist || !net.train) increment_layer(&output_layer, 1);
+    }
+
+    /* training keeps the state of every step, so the output projection can
+     * wait and take them all at once too */
+    if(hoist && net.train){
+        s.input = states + l.outputs*l.batch;
+        forward_all_steps(output_layer, s, l.steps);
     }
 }
 
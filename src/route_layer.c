@@ -71,6 +71,92 @@ void resize_route_layer(route_layer *l, network *net)
     
 }
 
+/* layers whose output and delta are plain buffers of their own that
+ * nothing else points at, so they can live inside a route's */
+static int routable(network *net, layer *p)
+{
+    int i;
+    switch(p->type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+        case CONNECTED:
+        case LOCAL:
+        case MAXPOOL:
+        case AVGPOOL:
+        case UPSAMPLE:
+        case SHORTCUT:
+        case ROUTE:
+        case BATCHNORM:
+        case ACTIVE:
+        case REORG:
+            break;
+        default:
+            return 0;
+    }
+    if(p->aliased || p->skipped || !p->output || !p->delta || p->batch != 1) return 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l != p && (l->output == p->output || l->delta == p->delta)) return 0;
+    }
+    return 1;
+}
+
+/* concatenation without copies. with batch 1 the inputs of a route sit one
+ * after another in its output, so each of them can write its output and
+ * take its delta in place there, and the route has nothing left to copy. a
+ * layer lives in one route at most, any other route it feeds still copies.
+ * routes go from the last one back, and a route that was itself placed in a
+ * later route keeps copying its own inputs, routes are not nested. a route
+ * with a single input just shares the buffers of that input, at any batch */
+void plan_routes(network *net)
+{
+    int i, j;
+    for(i = net->n - 1; i >= 0; --i){
+        layer *r = net->layers + i;
+        if(r->type != ROUTE || r->n < 2 || r->batch != 1 || r->aliased || !r->output || !r->delta) continue;
+        int offset = 0;
+        for(j = 0; j < r->n; ++j){
+            layer *p = net->layers + r->input_layers[j];
+            if(p->outputs == r->input_sizes[j] && routable(net, p)){
+                free(p->output);
+                free(p->delta);
+                p->output = r->output + offset;
+                p->delta = r->delta + offset;
+                p->aliased = 1;
+            }
+            offset += r->input_sizes[j];
+        }
+    }
+    for(i = 0; i < net->n; ++i){
+        layer *r = net->layers + i;
+        if(r->type != ROUTE || r->n != 1 || r->aliased) continue;
+        layer *p = net->layers + r->input_layers[0];
+        if(!p->output || !p->delta || p->outputs != r->outputs) continue;
+        free(r->output);
+        free(r->delta);
+        r->output = p->output;
+        r->delta = p->delta;
+        r->aliased = 1;
+    }
+}
+
+/* gives every layer its own buffers back, their contents are lost. they are
+ * sized for as many images as the other buffers hold, not the current
+ * batch, so set_batch_network can grow the batch back again */
+void unplan_routes(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!l->aliased) continue;
+        int batch = net->batch_capacity > l->batch ? net->batch_capacity : l->batch;
+        l->output = calloc(l->outputs*batch, sizeof(float));
+        l->delta = calloc(l->outputs*batch, sizeof(float));
+        l->aliased = 0;
+    }
+}
+
+/* inputs placed by plan_routes are already where they belong */
 void forward_route_layer(const route_layer l, network net)
 {
     int i, j;
@@ -79,6 +165,10 @@ void forward_route_layer(const route_layer l, network net)
         int index = l.input_layers[i];
         float *input = net.layers[index].output;
         int input_size = l.input_sizes[i];
+        if(input == l.output + offset){
+            offset += input_size;
+            continue;
+        }
         for(j = 0; j < l.batch; ++j){
             copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
         }
@@ -94,6 +184,10 @@ void backward_route_layer(const route_layer l, network net)
         int index = l.input_layers[i];
         float *delta = net.layers[index].delta;
         int input_size = l.input_sizes[i];
+        if(delta == l.delta + offset){
+            offset += input_size;
+            continue;
+        }
         for(j = 0; j < l.batch; ++j){
             axpy_cpu(input_size, 1, l.delta + offset + j*l.outputs, 1, delta + j*input_size, 1);
         }
@@ -9,6 +9,8 @@ route_layer make_route_layer(int batch, int n, int *input_layers, int *input_siz
 void forward_route_layer(const route_layer l, network net);
 void backward_route_layer(const route_layer l, network net);
 void resize_route_layer(route_layer *l, network *net);
+void plan_routes(network *net);
+void unplan_routes(network *net);
 
 #ifdef GPU
 void forward_route_layer_gpu(const route_layer l, network net);
@@ -59,8 +59,19 @@ void resize_shortcut_layer(layer *l, int w, int h)
 }
 
 
+/* the usual residual block adds two tensors of the same shape, that is one
+ * pass for the add and the activation together */
+static int same_shape(const layer l)
+{
+    return l.w == l.out_w && l.h == l.out_h && l.c == l.out_c;
+}
+
 void forward_shortcut_layer(const layer l, network net)
 {
+    if(same_shape(l)){
+        add_activate_array(net.input, l.alpha, net.layers[l.index].output, l.beta, l.output, l.outputs*l.batch, l.activation);
+        return;
+    }
     copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
     shortcut_cpu(l.batch, l.w, l.h, l.c, net.layers[l.index].output, l.out_w, l.out_h, l.out_c, l.alpha, l.beta, l.output);
     activate_array(l.output, l.outputs*l.batch, l.activation);
@@ -69,6 +80,15 @@ void forward_shortcut_layer(const layer l, network net)
 void backward_shortcut_layer(const layer l, network net)
 {
     gradient_array(l.output, l.outputs*l.batch, l.activation, l.delta);
+    if(same_shape(l) && net.delta){
+        int i;
+        float *add = net.layers[l.index].delta;
+        for(i = 0; i < l.outputs*l.batch; ++i){
+            net.delta[i] += l.alpha*l.delta[i];
+            add[i] += l.beta*l.delta[i];
+        }
+        return;
+    }
     axpy_cpu(l.outputs*l.batch, l.alpha, l.delta, 1, net.delta, 1);
     shortcut_cpu(l.batch, l.out_w, l.out_h, l.out_c, l.delta, l.w, l.h, l.c, 1, l.beta, net.layers[l.index].delta);
 }
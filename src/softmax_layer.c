@@ -1,4 +1,5 @@
 #include "softmax_layer.h"
+#include "activations.h"
 #include "blas.h"
 #include "cuda.h"
 
@@ -39,11 +40,14 @@ softmax_layer make_softmax_layer(int batch, int inputs, int groups)
 void forward_softmax_layer(const softmax_layer l, network net)
 {
     if(l.softmax_tree){
-        int i;
+        int i, b;
         int count = 0;
         for (i = 0; i < l.softmax_tree->groups; ++i) {
             int group_size = l.softmax_tree->group_size[i];
-            softmax_cpu(net.input + count, group_size, l.batch, l.inputs, 1, 0, 1, l.temperature, l.output + count);
+            for(b = 0; b < l.batch; ++b){
+                int index = b*l.inputs + count;
+                softmax_planes_cpu(net.input + index, group_size, 1, 1, l.temperature, l.output + index);
+            }
             count += group_size;
         }
     } else {
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "tree.h"
 #include "utils.h"
 #include "data.h"
@@ -36,37 +37,37 @@ float get_hierarchy_probability(float *x, tree *hier, int c, int stride)
 
 void hierarchy_predictions(float *predictions, int n, tree *hier, int only_leaves, int stride)
 {
-    int j;
+    hierarchy_predictions_planes(predictions, n, hier, only_leaves, stride, 1);
+}
+
+/* hierarchy_predictions for len boxes at once, box i of entry j at
+ * j*stride + i, parents come before their children so one pass in order
+ * multiplies whole planes */
+void hierarchy_predictions_planes(float *predictions, int n, tree *hier, int only_leaves, int stride, int len)
+{
+    int i, j;
     for(j = 0; j < n; ++j){
         int parent = hier->parent[j];
+        float *x = predictions + j*stride;
         if(parent >= 0){
-            predictions[j*stride] *= predictions[parent*stride]; 
+            float *p = predictions + parent*stride;
+            for(i = 0; i < len; ++i) x[i] *= p[i];
         }
     }
     if(only_leaves){
         for(j = 0; j < n; ++j){
-            if(!hier->leaf[j]) predictions[j*stride] = 0;
+            if(!hier->leaf[j]) memset(predictions + j*stride, 0, len*sizeof(float));
         }
     }
 }
 
-int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int stride)
+/* walks down from the best entry of the root group, max and max_i */
+static int descend_hierarchy(float *predictions, tree *hier, float thresh, int stride, float max, int max_i)
 {
     float p = 1;
     int group = 0;
     int i;
     while(1){
-        float max = 0;
-        int max_i = 0;
-
-        for(i = 0; i < hier->group_size[group]; ++i){
-            int index = i + hier->group_offset[group];
-            float val = predictions[(i + hier->group_offset[group])*stride];
-            if(val > max){
-                max_i = index;
-                max = val;
-            }
-        }
         if(p*max > thresh){
             p = p*max;
             group = hier->child[max_i];
@@ -76,10 +77,56 @@ int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int s
         } else {
             return hier->parent[hier->group_offset[group]];
         }
+
+        max = 0;
+        max_i = 0;
+        for(i = 0; i < hier->group_size[group]; ++i){
+            int index = i + hier->group_offset[group];
+            float val = predictions[index*stride];
+            if(val > max){
+                max_i = index;
+                max = val;
+            }
+        }
     }
     return 0;
 }
 
+int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int stride)
+{
+    int top[1];
+    hierarchy_top_predictions(predictions, hier, thresh, stride, 1, top);
+    return top[0];
+}
+
+/* hierarchy_top_prediction for len boxes laid out as in
+ * hierarchy_predictions_planes. every box starts in the root group, so that
+ * one is scanned a plane at a time for all of them, below it the paths part */
+void hierarchy_top_predictions(float *predictions, tree *hier, float thresh, int stride, int len, int *top)
+{
+    int i, j, c;
+    float max[256];
+    int max_i[256];
+    for(c = 0; c < len; c += 256){
+        int m = len - c < 256 ? len - c : 256;
+        for(i = 0; i < m; ++i){
+            max[i] = 0;
+            max_i[i] = 0;
+        }
+        for(j = 0; j < hier->group_size[0]; ++j){
+            int index = j + hier->group_offset[0];
+            float *x = predictions + index*stride + c;
+            for(i = 0; i < m; ++i){
+                max_i[i] = x[i] > max[i] ? index : max_i[i];
+                max[i] = x[i] > max[i] ? x[i] : max[i];
+            }
+        }
+        for(i = 0; i < m; ++i){
+            top[c + i] = descend_hierarchy(predictions + c + i, hier, thresh, stride, max[i], max_i[i]);
+        }
+    }
+}
+
 tree *read_tree(char *filename)
 {
     tree t = {0};
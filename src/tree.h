@@ -3,6 +3,8 @@
 #include "darknet.h"
 
 int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int stride);
+void hierarchy_top_predictions(float *predictions, tree *hier, float thresh, int stride, int len, int *top);
+void hierarchy_predictions_planes(float *predictions, int n, tree *hier, int only_leaves, int stride, int len);
 float get_hierarchy_probability(float *x, tree *hier, int c, int stride);
 
 #endif
@@ -446,21 +446,87 @@ void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth
     }
 }
 
+/* objectness of anchor n is contiguous over the l.w*l.h cells, so these scans
+ * are branch free straight-line loops the compiler vectorizes. objectness is a
+ * logistic output, never negative, so comparing the bit patterns as integers
+ * orders it the same as a float compare while staying identical in both scans
+ * under -Ofast, where a NaN from a diverged net may otherwise be counted by one
+ * and not the other and overrun the boxes sized from the count */
+static int yolo_above(float x, int thresh)
+{
+    int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits > thresh;
+}
+
+static int yolo_count_above(float *obj, int n, float thresh)
+{
+    int i;
+    int count = 0;
+    int t;
+    memcpy(&t, &thresh, sizeof(t));
+    for(i = 0; i < n; ++i){
+        count += yolo_above(obj[i], t);
+    }
+    return count;
+}
+
+static int yolo_select_above(float *obj, int n, float thresh, int *cells)
+{
+    int i;
+    int count = 0;
+    int t;
+    memcpy(&t, &thresh, sizeof(t));
+    for(i = 0; i < n; ++i){
+        cells[count] = i;
+        count += yolo_above(obj[i], t);
+    }
+    return count;
+}
+
 int yolo_num_detections(layer l, float thresh)
 {
-    int i, n;
+    int n;
     int count = 0;
-    for (i = 0; i < l.w*l.h; ++i){
-        for(n = 0; n < l.n; ++n){
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
-            if(l.output[obj_index] > thresh){
-                ++count;
-            }
-        }
+    for(n = 0; n < l.n; ++n){
+        int obj_index = entry_index(l, 0, n*l.w*l.h, 4);
+        count += yolo_count_above(l.output + obj_index, l.w*l.h, thresh);
     }
+    if(l.pre_nms_topk > 0 && count > l.pre_nms_topk) count = l.pre_nms_topk;
     return count;
 }
 
+/* the locations n*l.w*l.h + i of the cells above thresh. past pre_nms_topk
+ * only the highest objectness survive, exact on ties, so the boxes and class
+ * scores decoded afterwards are bounded by the option and not by the grid */
+static int yolo_candidates(layer l, float thresh, int *cand)
+{
+    int n, k;
+    int count = 0;
+    for(n = 0; n < l.n; ++n){
+        int obj_index = entry_index(l, 0, n*l.w*l.h, 4);
+        int m = yolo_select_above(l.output + obj_index, l.w*l.h, thresh, cand + count);
+        for(k = 0; k < m; ++k) cand[count + k] += n*l.w*l.h;
+        count += m;
+    }
+    if(l.pre_nms_topk <= 0 || count <= l.pre_nms_topk) return count;
+
+    float *obj = calloc(count, sizeof(float));
+    for(k = 0; k < count; ++k) obj[k] = l.output[entry_index(l, 0, cand[k], 4)];
+    float v = select_kth_largest(obj, count, l.pre_nms_topk);
+    free(obj);
+    int ties = l.pre_nms_topk;
+    for(k = 0; k < count; ++k){
+        if(l.output[entry_index(l, 0, cand[k], 4)] > v) --ties;
+    }
+    int kept = 0;
+    for(k = 0; k < count; ++k){
+        float o = l.output[entry_index(l, 0, cand[k], 4)];
+        if(o > v || (o == v && ties-- > 0)) cand[kept++] = cand[k];
+    }
+    return kept;
+}
+
 void avg_flipped_yolo(layer l)
 {
     int i,j,n,z;
@@ -487,39 +553,56 @@ void avg_flipped_yolo(layer l)
     }
 }
 
-int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets)
+static void decode_yolo_detection(layer l, int n, int i, int netw, int neth, float thresh, detection *det)
 {
-    int i,j,n;
+    int j;
     float *predictions = l.output;
-    if (l.batch == 2) avg_flipped_yolo(l);
-    int count = 0;
-    for (i = 0; i < l.w*l.h; ++i)
+    int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
+    int box_index  = entry_index(l, 0, n*l.w*l.h + i, 0);
+    float objectness = predictions[obj_index];
+    det->bbox = get_yolo_box(predictions, l.biases, l.mask[n], box_index, i % l.w, i / l.w, l.w, l.h, netw, neth, l.w*l.h);
+    det->objectness = objectness;
+    det->classes = l.classes;
+    for(j = 0; j < l.classes; ++j)
     {
-        int row = i / l.w;
-        int col = i % l.w;
-        for(n = 0; n < l.n; ++n)
-        {
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
-            float objectness = predictions[obj_index];
-            if(objectness <= thresh) 
-                continue;
-            int box_index  = entry_index(l, 0, n*l.w*l.h + i, 0);
-            dets[count].bbox = get_yolo_box(predictions, l.biases, l.mask[n], box_index, col, row, l.w, l.h, netw, neth, l.w*l.h);
-            dets[count].objectness = objectness;
-            dets[count].classes = l.classes;
-            for(j = 0; j < l.classes; ++j)
-            {
-                int class_index = entry_index(l, 0, n*l.w*l.h + i, 4 + 1 + j);
-                float prob = objectness*predictions[class_index];
-                dets[count].prob[j] = (prob > thresh) ? prob : 0;
-            }
-            ++count;
-        }
+        int class_index = entry_index(l, 0, n*l.w*l.h + i, 4 + 1 + j);
+        float prob = objectness*predictions[class_index];
+        det->prob[j] = (prob > thresh) ? prob : 0;
     }
+}
+
+int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets)
+{
+    int k;
+    if (l.batch == 2) avg_flipped_yolo(l);
+    int *cand = calloc(l.n*l.w*l.h, sizeof(int));
+    int count = yolo_candidates(l, thresh, cand);
+    for(k = 0; k < count; ++k){
+        decode_yolo_detection(l, cand[k] / (l.w*l.h), cand[k] % (l.w*l.h), netw, neth, thresh, dets + k);
+    }
+    free(cand);
     correct_yolo_boxes(dets, count, w, h, netw, neth, relative);
     return count;
 }
 
+int stream_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int relative, detection_handler handler, void *ctx)
+{
+    int k;
+    if (l.batch == 2) avg_flipped_yolo(l);
+    int *cand = calloc(l.n*l.w*l.h, sizeof(int));
+    detection det = {0};
+    det.prob = calloc(l.classes, sizeof(float));
+    int count = yolo_candidates(l, thresh, cand);
+    for(k = 0; k < count; ++k){
+        decode_yolo_detection(l, cand[k] / (l.w*l.h), cand[k] % (l.w*l.h), netw, neth, thresh, &det);
+        correct_yolo_boxes(&det, 1, w, h, netw, neth, relative);
+        handler(&det, ctx);
+    }
+    free(det.prob);
+    free(cand);
+    return count;
+}
+
 #ifdef GPU
 
 void forward_yolo_layer_gpu(const layer l, network net)